@@ -0,0 +1,144 @@
+#include "accesslog.h"
+#include "worker.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct {
+    int fd;
+    pthread_t thread;
+    int stop;
+    char *buf;
+    int len;
+} access_log = { .fd = -1 };
+
+log_ring_t *new_log_ring()
+{
+    log_ring_t *ring = aligned_alloc(CACHE_LINE, sizeof(log_ring_t));
+    if (ring == NULL) {
+        perror("allocating the access log failed");
+        exit(1);
+    }
+    memset(ring, 0, sizeof(log_ring_t));
+    return ring;
+}
+
+// the tail is only read when the ring looks full, so the worker rarely
+// touches the log thread's cache line
+log_record_t *log_reserve(log_ring_t *ring)
+{
+    if (ring->head - ring->tail_seen >= LOG_RING_SIZE) {
+        ring->tail_seen = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (ring->head - ring->tail_seen >= LOG_RING_SIZE) {
+            stat_add(ring->dropped, 1);
+            return NULL;
+        }
+    }
+    return &ring->records[ring->head & (LOG_RING_SIZE - 1)];
+}
+
+void log_commit(log_ring_t *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static void flush_log()
+{
+    if (access_log.len == 0)
+        return;
+    for (int done = 0; done < access_log.len; ) {
+        ssize_t n = write(access_log.fd, access_log.buf + done, access_log.len - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("writing the access log failed");
+            break;
+        }
+        done += n;
+    }
+    access_log.len = 0;
+}
+
+// client [time] "method url" status bytes seconds
+static void format_record(log_record_t *record)
+{
+    char ip[INET_ADDRSTRLEN], date[32];
+    struct tm tm;
+
+    if (LOG_BUF_SIZE - access_log.len < LOG_URL_SIZE + 256)
+        flush_log();
+
+    inet_ntop(AF_INET, &record->addr.sin_addr, ip, sizeof(ip));
+    gmtime_r(&record->time.tv_sec, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+    access_log.len += sprintf(access_log.buf + access_log.len, "%s:%d [%s.%06ldZ] \"%s %s\" %d %lld %.6f\n",
+            ip, ntohs(record->addr.sin_port), date, record->time.tv_nsec / 1000,
+            record->method, record->url, record->status, record->bytes, record->usec / 1e6);
+}
+
+// move everything the workers have logged into the buffer, returns the
+// number of records taken
+static unsigned long drain_rings()
+{
+    unsigned long taken = 0;
+
+    for (int i = 0; i < nworkers; i++) {
+        log_ring_t *ring = workers[i].loop.log;
+        unsigned long head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (unsigned long tail = ring->tail; tail != head; tail++)
+            format_record(&ring->records[tail & (LOG_RING_SIZE - 1)]);
+        taken += head - ring->tail;
+        __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+    }
+    return taken;
+}
+
+static void *log_thread(void *arg)
+{
+    // keep draining while the workers keep up the pace, a full buffer is
+    // written out on the way
+    while (!__atomic_load_n(&access_log.stop, __ATOMIC_RELAXED)) {
+        if (drain_rings() >= LOG_RING_SIZE / 4)
+            continue;
+        flush_log();
+        struct timespec ts = { 0, LOG_FLUSH_MSEC * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    drain_rings();
+    flush_log();
+    return NULL;
+}
+
+// the workers must have been started, "-" logs to stdout
+void start_access_log(const char *path)
+{
+    if (strcmp(path, "-") == 0)
+        access_log.fd = STDOUT_FILENO;
+    else
+        access_log.fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (access_log.fd < 0) {
+        perror("opening the access log failed");
+        exit(1);
+    }
+
+    access_log.buf = malloc(LOG_BUF_SIZE);
+    if (access_log.buf == NULL || pthread_create(&access_log.thread, NULL, log_thread, NULL)) {
+        perror("starting the access log failed");
+        exit(1);
+    }
+}
+
+// write out what is still buffered
+void stop_access_log()
+{
+    if (access_log.fd < 0)
+        return;
+    __atomic_store_n(&access_log.stop, 1, __ATOMIC_RELAXED);
+    pthread_join(access_log.thread, NULL);
+}
@@ -0,0 +1,140 @@
+#include "admission.h"
+#include "config.h"
+#include "http.h"
+#include "worker.h"
+
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// open connections of the client addresses, by slot
+static int client_conns[ADMISSION_IP_SLOTS];
+
+static long now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static int slot_of(const struct sockaddr_in *addr)
+{
+    unsigned hash = addr->sin_addr.s_addr * 2654435761u;
+    return hash >> 16 & (ADMISSION_IP_SLOTS - 1);
+}
+
+// connections waiting behind the one just accepted, in the listener's accept
+// queue and, with the ring, in accept completions not handled yet. The kernel
+// is asked once per turn and the count goes down from there.
+static int queued_behind(event_loop_t *loop, listener_t *listener)
+{
+    if (listener->queue_turn != loop->turns) {
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+        memset(&info, 0, sizeof(info));
+        // on a listening socket tcpi_unacked is the length of the accept queue
+        getsockopt(listener->fd, IPPROTO_TCP, TCP_INFO, &info, &len);
+        listener->queued = info.tcpi_unacked + (listener->completed > 0 ? listener->completed - 1 : 0);
+        listener->queue_turn = loop->turns;
+    } else if (listener->queued > 0) {
+        listener->queued--;
+    }
+    return listener->queued;
+}
+
+static long open_conns()
+{
+    long open = 0;
+    for (int i = 0; i < nworkers; i++)
+        open += __atomic_load_n(&workers[i].loop.nconns, __ATOMIC_RELAXED);
+    for (int i = 0; i < nhandshakers; i++)
+        open += __atomic_load_n(&handshakers[i].loop.nconns, __ATOMIC_RELAXED);
+    return open;
+}
+
+// answer a shed plaintext connection without setting it up. The request that
+// came along with it is read and dropped first, closing a socket with unread
+// data would reset the connection under the 503.
+static void answer_shed(event_loop_t *loop, int sock)
+{
+    char buf[REQUEST_BUF_SIZE];
+    while (recv(sock, buf, sizeof(buf), MSG_DONTWAIT) == sizeof(buf))
+        ;
+
+    int len;
+    const char *response = overload_response(&len);
+    long sent = send(sock, response, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent > 0)
+        stat_add(loop->metrics.bytes_sent, sent);
+    count_response(&loop->metrics, SERVICE_UNAVAILABLE, 0);
+}
+
+// no handshake for a shed TLS connection, closing it sends a reset
+static void reset_shed(int sock)
+{
+    struct linger linger = { .l_onoff = 1, .l_linger = 0 };
+    setsockopt(sock, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+}
+
+int admit_conn(event_loop_t *loop, listener_t *listener, int sock, const struct sockaddr_in *addr, int *client_slot)
+{
+    *client_slot = 0;
+    if (listener->role == SERVE_ADMIN)
+        return 0;
+
+    int reason = -1;
+    if (config.shed_queue > 0 && queued_behind(loop, listener) >= config.shed_queue)
+        reason = SHED_QUEUE;
+    else if (config.shed_lag > 0 && loop->lag_usec > config.shed_lag * 1000L)
+        reason = SHED_LAG;
+    else if (config.max_conns > 0 && open_conns() >= config.max_conns)
+        reason = SHED_CONNS;
+
+    // only admitted connections hold a place, a shed one goes away soon
+    if (reason < 0 && config.max_conns_per_ip > 0 && addr) {
+        int slot = slot_of(addr);
+        if (__atomic_add_fetch(&client_conns[slot], 1, __ATOMIC_RELAXED) > config.max_conns_per_ip) {
+            __atomic_sub_fetch(&client_conns[slot], 1, __ATOMIC_RELAXED);
+            reason = SHED_CLIENT;
+        } else {
+            *client_slot = slot + 1;
+        }
+    }
+
+    if (reason < 0)
+        return 0;
+    stat_add(loop->metrics.shed[reason], 1);
+    if (listener->role == SERVE_TLS)
+        reset_shed(sock);
+    else
+        answer_shed(loop, sock);
+    return -1;
+}
+
+void release_admission(int client_slot)
+{
+    if (client_slot)
+        __atomic_sub_fetch(&client_conns[client_slot - 1], 1, __ATOMIC_RELAXED);
+}
+
+static void add_lag(event_loop_t *loop, long usec)
+{
+    __atomic_store_n(&loop->lag_usec, loop->lag_usec + (usec - loop->lag_usec) / LAG_TURNS, __ATOMIC_RELAXED);
+}
+
+void start_turn(event_loop_t *loop)
+{
+    long now = now_usec();
+    if (now - loop->turn_usec >= loop->lag_usec)
+        add_lag(loop, 0);
+    loop->turn_usec = now;
+    loop->turns++;
+}
+
+void end_turn(event_loop_t *loop)
+{
+    long now = now_usec();
+    add_lag(loop, now - loop->turn_usec);
+    loop->turn_usec = now;
+}
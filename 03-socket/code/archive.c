@@ -0,0 +1,104 @@
+#include "archive.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *base;
+static const archive_header_t *header;
+static const uint32_t *seeds;
+static const uint32_t *slots;
+static const archive_file_t *files;
+
+// whether len bytes at off lie inside an archive of size bytes
+static int inside(uint64_t off, uint64_t len, uint64_t size)
+{
+    return off <= size && len <= size - off;
+}
+
+static int check_archive(uint64_t size)
+{
+    if (size < sizeof(archive_header_t) || memcmp(header->magic, ARCHIVE_MAGIC, 8) != 0)
+        return -1;
+    if (header->version != ARCHIVE_VERSION || header->size != size)
+        return -1;
+    if (header->nbuckets == 0 || (header->nbuckets & (header->nbuckets - 1)) ||
+            header->nslots == 0 || (header->nslots & (header->nslots - 1)) || header->nfiles > header->nslots)
+        return -1;
+    if (header->seeds_off % 4 || header->slots_off % 4 || header->files_off % 8 ||
+            !inside(header->seeds_off, header->nbuckets * 4ull, size) ||
+            !inside(header->slots_off, header->nslots * 4ull, size) ||
+            !inside(header->files_off, header->nfiles * (uint64_t)sizeof(archive_file_t), size))
+        return -1;
+
+    for (uint32_t i = 0; i < header->nslots; i++) {
+        if (slots[i] != ARCHIVE_EMPTY && slots[i] >= header->nfiles)
+            return -1;
+    }
+    for (uint32_t i = 0; i < header->nfiles; i++) {
+        const archive_file_t *file = &files[i];
+        if (!inside(file->url_off, file->url_len + 1ull, size) || base[file->url_off + file->url_len] != '\0' ||
+                file->header_len >= ARCHIVE_MAX_HEADER || file->gzip_header_len >= ARCHIVE_MAX_HEADER ||
+                !inside(file->header_off, file->header_len, size) ||
+                !inside(file->data_off, file->size, size) ||
+                !inside(file->gzip_header_off, file->gzip_header_len, size) ||
+                !inside(file->gzip_off, file->gzip_size, size))
+            return -1;
+    }
+    return 0;
+}
+
+int open_archive(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open archive failed");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "%s: not an archive\n", path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap archive failed");
+        return -1;
+    }
+
+    base = map;
+    header = map;
+    seeds = (const uint32_t *)(base + header->seeds_off);
+    slots = (const uint32_t *)(base + header->slots_off);
+    files = (const archive_file_t *)(base + header->files_off);
+    if (check_archive(st.st_size) < 0) {
+        fprintf(stderr, "%s: not an archive or a damaged one, pack it again\n", path);
+        munmap(map, st.st_size);
+        base = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+const archive_file_t *archive_lookup(const char *url, int len)
+{
+    uint32_t seed = seeds[archive_hash(url, len, 0) & (header->nbuckets - 1)];
+    uint32_t i = slots[archive_hash(url, len, seed) & (header->nslots - 1)];
+    if (i == ARCHIVE_EMPTY)
+        return NULL;
+
+    const archive_file_t *file = &files[i];
+    if (file->url_len != (uint32_t)len || memcmp(base + file->url_off, url, len) != 0)
+        return NULL;
+    return file;
+}
+
+const char *archive_at(uint64_t off)
+{
+    return base + off;
+}
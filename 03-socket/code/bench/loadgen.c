@@ -0,0 +1,1089 @@
+// load generator: worker threads drive many non-blocking HTTP or HTTPS
+// connections against the server, either closed-loop (every connection sends
+// its next request as soon as the previous response is in) or open-loop at a
+// constant request rate, where latency is measured from when a request was
+// due rather than when a connection got around to sending it. Each request is
+// drawn from a mix of 200, 206, 301 and 404 requests, 301s go to the redirect
+// port. Latency and the time to the first response byte go into log-linear
+// histograms and the results are printed as CSV, one row per kind of request
+// plus a total, so runs can be appended to one file and compared across
+// commits. A 503 of the server's admission control is counted as shed, it is
+// neither a success nor an error, so req_per_s stays the goodput.
+//
+// With --slowloris N a separate thread holds N more connections open the way
+// a slow client does: each one trickles a header line per interval and never
+// finishes its request (on the tls port it never starts the handshake), and
+// is reconnected whenever the server gives up on it.
+//
+//   make bench
+//   ./loadgen --tls -c 100 -d 10 --label $(git rev-parse --short HEAD)
+//   ./loadgen --tls -k -c 100 -r 20000 -m 200=80,206=10,301=5,404=5 --no-header >> results.csv
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EVENTS 256
+#define HEAD_SIZE 4096
+#define READ_SIZE (64 << 10)
+
+// log-linear histogram of nanoseconds: values below 2^HIST_SUB_BITS are
+// exact, above that every power of two is split into 2^(HIST_SUB_BITS - 1)
+// buckets, so a recorded value is off by less than 1%
+#define HIST_SUB_BITS 8
+#define HIST_HALF (1 << (HIST_SUB_BITS - 1))
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_HALF + HIST_HALF)
+
+// kinds of requests in the mix
+enum kind { KIND_200, KIND_206, KIND_301, KIND_404, NKINDS };
+
+static const char *kind_names[NKINDS] = { "200", "206", "301", "404" };
+static const int kind_status[NKINDS] = { 200, 206, 301, 404 };
+
+// redirects are answered on their own port, so connections are split between
+// the two targets
+enum target { TARGET_FILES, TARGET_REDIRECT, NTARGETS };
+
+enum client_state {
+    C_IDLE,                             // no request, may or may not be connected
+    C_CONNECT,
+    C_HANDSHAKE,
+    C_WRITE,
+    C_READ,
+};
+
+typedef struct hist {
+    unsigned long counts[HIST_BUCKETS];
+    unsigned long total;
+    unsigned long max;
+} hist_t;
+
+typedef struct kind_stats {
+    hist_t hist;
+    hist_t ttfb;                        // until the first response byte
+    unsigned long errors;               // failed requests or unexpected statuses
+    unsigned long shed;                 // turned away with a 503, not errors
+    unsigned long bytes;                // response bytes received
+} kind_stats_t;
+
+// a request that is due but waits for a free connection, open-loop only
+typedef struct pending {
+    long due;
+    int kind;
+} pending_t;
+
+#define MAX_PENDING (1 << 16)
+
+typedef struct client {
+    int fd;                             // -1 when not connected
+    SSL *ssl;
+    SSL_SESSION *session;               // resumed on the next connection
+    int target;
+    int state;
+    int events;                         // registered with epoll
+    int requests;                       // requests sent on this connection
+
+    int kind;                           // request in flight
+    long start;                         // when it was due
+    long first_byte;                    // when the response started, 0 before
+    char request[512];
+    int request_len;
+    int request_sent;
+
+    char head[HEAD_SIZE + 1];           // response headers received so far
+    int head_len;
+    int status;
+    long body_left;                     // -1 reads the body until the server closes
+    int server_close;                   // server announced Connection: close
+    long bytes;                         // response bytes received
+} client_t;
+
+typedef struct worker {
+    pthread_t thread;
+    int epfd;
+    client_t *clients;
+    int nclients;
+    int *idle[NTARGETS];                // free connections of each target
+    int nidle[NTARGETS];
+
+    pending_t *pending[NTARGETS];       // ring of due requests, open-loop only
+    unsigned head[NTARGETS], tail[NTARGETS];
+    double rate;                        // requests per second of this worker
+
+    int busy;                           // connections with a request in flight
+    unsigned long seed;
+    char *read_buf;
+
+    kind_stats_t stats[NKINDS];
+    unsigned long connects;
+    unsigned long resumed;
+    unsigned long dropped;              // due requests that found the queue full
+} worker_t;
+
+static struct {
+    const char *host;
+    struct sockaddr_in addr;
+    int port;
+    int redirect_port;
+    int tls;
+    int keep_alive;
+    int resume;
+    int concurrency;
+    int threads;
+    double rate;                        // 0 runs closed-loop
+    double duration;
+    double warmup;
+    double timeout;
+    int weights[NKINDS];
+    const char *url;
+    const char *range;
+    const char *label;
+    int header;
+    int slow_conns;                     // slowloris connections held on the side
+    double slow_interval;               // seconds between their header lines
+} config = {
+    .host = "127.0.0.1",
+    .port = 443,
+    .redirect_port = 80,
+    .resume = 1,
+    .concurrency = 64,
+    .threads = 1,
+    .duration = 10,
+    .warmup = 1,
+    .timeout = 5,
+    .weights = { 100, 0, 0, 0 },
+    .url = "/index.html",
+    .range = "0-1023",
+    .label = "",
+    .header = 1,
+    .slow_interval = 1,
+};
+
+static SSL_CTX *ssl_ctx;
+
+// the measurement window, requests due outside of it are not recorded
+static long measure_start, measure_end;
+
+static long now_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int hist_index(unsigned long v)
+{
+    if (v < (1UL << HIST_SUB_BITS))
+        return v;
+    int shift = 63 - __builtin_clzl(v) - (HIST_SUB_BITS - 1);
+    return (shift + 1) * HIST_HALF + (v >> shift) - HIST_HALF;
+}
+
+// highest value that falls into the bucket
+static unsigned long hist_value(int index)
+{
+    if (index < (1 << HIST_SUB_BITS))
+        return index;
+    int shift = index / HIST_HALF - 1;
+    unsigned long sub = index % HIST_HALF + HIST_HALF;
+    return ((sub + 1) << shift) - 1;
+}
+
+static void hist_record(hist_t *hist, unsigned long v)
+{
+    hist->counts[hist_index(v)]++;
+    hist->total++;
+    if (v > hist->max)
+        hist->max = v;
+}
+
+static void hist_merge(hist_t *to, const hist_t *from)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        to->counts[i] += from->counts[i];
+    to->total += from->total;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+static unsigned long hist_percentile(const hist_t *hist, double p)
+{
+    if (hist->total == 0)
+        return 0;
+    unsigned long rank = (unsigned long)(hist->total * p / 100);
+    if (rank >= hist->total)
+        rank = hist->total - 1;
+    unsigned long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen > rank)
+            return hist_value(i) < hist->max ? hist_value(i) : hist->max;
+    }
+    return hist->max;
+}
+
+static unsigned long next_random(worker_t *w)
+{
+    // xorshift64
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 7;
+    w->seed ^= w->seed << 17;
+    return w->seed;
+}
+
+static int kind_target(int kind)
+{
+    return kind == KIND_301 ? TARGET_REDIRECT : TARGET_FILES;
+}
+
+// draw a kind of request from the weights of the kinds the target serves,
+// or from the whole mix if target is -1
+static int pick_kind(worker_t *w, int target)
+{
+    int total = 0;
+    for (int k = 0; k < NKINDS; k++) {
+        if (target < 0 || kind_target(k) == target)
+            total += config.weights[k];
+    }
+    int r = next_random(w) % total;
+    for (int k = 0; k < NKINDS; k++) {
+        if (target >= 0 && kind_target(k) != target)
+            continue;
+        if (r < config.weights[k])
+            return k;
+        r -= config.weights[k];
+    }
+    return KIND_200;
+}
+
+static void set_events(worker_t *w, client_t *c, int events)
+{
+    if (c->events == events)
+        return;
+    struct epoll_event ev = { .events = events, .data.ptr = c };
+    epoll_ctl(w->epfd, c->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, c->fd, &ev);
+    c->events = events;
+}
+
+// keep the session of a connection that served a response, tls 1.3 tickets
+// come after the handshake so it is taken once the response is in
+static void save_session(client_t *c)
+{
+    if (!config.resume || c->ssl == NULL)
+        return;
+    SSL_SESSION *session = SSL_get1_session(c->ssl);
+    if (session == NULL)
+        return;
+    if (c->session)
+        SSL_SESSION_free(c->session);
+    c->session = session;
+}
+
+static void disconnect(worker_t *w, client_t *c)
+{
+    if (c->ssl) {
+        // freeing without a close_notify marks the session not resumable
+        SSL_shutdown(c->ssl);
+        SSL_free(c->ssl);
+        ERR_clear_error();
+        c->ssl = NULL;
+    }
+    if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->events = 0;
+    c->requests = 0;
+}
+
+static int start_connect(worker_t *w, client_t *c)
+{
+    struct sockaddr_in addr = config.addr;
+    addr.sin_port = htons(c->target == TARGET_REDIRECT ? config.redirect_port : config.port);
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    w->connects++;
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS)
+        return -1;
+
+    if (config.tls && c->target == TARGET_FILES) {
+        c->ssl = SSL_new(ssl_ctx);
+        SSL_set_fd(c->ssl, c->fd);
+        SSL_set_tlsext_host_name(c->ssl, config.host);
+        if (c->session)
+            SSL_set_session(c->ssl, c->session);
+    }
+    c->state = C_CONNECT;
+    return 0;
+}
+
+static void build_request(client_t *c)
+{
+    const char *connection = config.keep_alive ? "" : "Connection: close\r\n";
+
+    if (c->kind == KIND_206)
+        c->request_len = snprintf(c->request, sizeof(c->request),
+                "GET %s HTTP/1.1\r\nHost: %s\r\nRange: bytes=%s\r\n%s\r\n",
+                config.url, config.host, config.range, connection);
+    else if (c->kind == KIND_404)
+        c->request_len = snprintf(c->request, sizeof(c->request),
+                "GET /loadgen-missing-%d HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+                c->requests, config.host, connection);
+    else
+        c->request_len = snprintf(c->request, sizeof(c->request),
+                "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n", config.url, config.host, connection);
+    c->request_sent = 0;
+    c->head_len = 0;
+    c->status = 0;
+    c->body_left = 0;
+    c->server_close = 0;
+    c->bytes = 0;
+    c->first_byte = 0;
+}
+
+static void start_request(worker_t *w, client_t *c, int kind, long due)
+{
+    c->kind = kind;
+    c->start = due;
+    w->busy++;
+    build_request(c);
+    if (c->fd < 0 && start_connect(w, c) < 0) {
+        disconnect(w, c);
+        c->state = C_CONNECT;           // reported as an error on the next step
+        return;
+    }
+    if (c->state == C_IDLE)
+        c->state = C_WRITE;
+}
+
+// requests due within the measurement window are recorded, however late they
+// complete
+static void record(worker_t *w, client_t *c, int ok)
+{
+    if (c->start < measure_start || c->start >= measure_end)
+        return;
+    kind_stats_t *stats = &w->stats[c->kind];
+    stats->bytes += c->bytes;
+    if (ok && c->status == kind_status[c->kind]) {
+        hist_record(&stats->hist, now_nsec() - c->start);
+        hist_record(&stats->ttfb, c->first_byte - c->start);
+    } else if (ok && c->status == 503) {
+        stats->shed++;
+    } else
+        stats->errors++;
+}
+
+// the headers are complete once they end in a blank line, returns 1 then,
+// 0 if more is needed, -1 on a malformed response
+static int parse_head(client_t *c)
+{
+    char *end = strstr(c->head, "\r\n\r\n");
+    if (end == NULL)
+        return c->head_len >= HEAD_SIZE ? -1 : 0;
+
+    if (sscanf(c->head, "HTTP/1.%*d %d", &c->status) != 1)
+        return -1;
+
+    c->body_left = c->status == 304 ? 0 : -1;
+    for (char *line = strstr(c->head, "\r\n") + 2; line < end; ) {
+        char *eol = strstr(line, "\r\n");
+        *eol = '\0';
+        if (strncasecmp(line, "Content-Length:", 15) == 0)
+            c->body_left = atol(line + 15);
+        else if (strncasecmp(line, "Connection:", 11) == 0 && strcasestr(line, "close"))
+            c->server_close = 1;
+        *eol = '\r';
+        line = eol + 2;
+    }
+
+    // body bytes that came in with the headers, nothing may follow the body
+    // since requests are not pipelined
+    int body = c->head_len - (end + 4 - c->head);
+    if (c->body_left >= 0) {
+        if (body > c->body_left)
+            return -1;
+        c->body_left -= body;
+    }
+    return 1;
+}
+
+static ssize_t client_read(client_t *c, char *buf, int len, int *want)
+{
+    if (c->ssl) {
+        int n = SSL_read(c->ssl, buf, len);
+        if (n > 0)
+            return n;
+        int err = SSL_get_error(c->ssl, n);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            *want = err == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT;
+            errno = EAGAIN;
+            return -1;
+        }
+        if (err == SSL_ERROR_ZERO_RETURN)
+            return 0;
+        errno = EIO;
+        return -1;
+    }
+    *want = EPOLLIN;
+    return read(c->fd, buf, len);
+}
+
+static ssize_t client_write(client_t *c, const char *buf, int len, int *want)
+{
+    if (c->ssl) {
+        int n = SSL_write(c->ssl, buf, len);
+        if (n > 0)
+            return n;
+        int err = SSL_get_error(c->ssl, n);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            *want = err == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT;
+            errno = EAGAIN;
+            return -1;
+        }
+        errno = EIO;
+        return -1;
+    }
+    *want = EPOLLOUT;
+    return write(c->fd, buf, len);
+}
+
+// the response is complete, hand the connection back
+static void finish_request(worker_t *w, client_t *c, int ok)
+{
+    record(w, c, ok);
+    w->busy--;
+    if (ok && c->requests == 1)
+        save_session(c);
+    if (!ok || !config.keep_alive || c->server_close)
+        disconnect(w, c);
+    else if (c->fd >= 0)
+        set_events(w, c, EPOLLIN);      // notices the server closing an idle connection
+    c->state = C_IDLE;
+    w->idle[c->target][w->nidle[c->target]++] = c - w->clients;
+}
+
+// move the connection along until it would block
+static void step(worker_t *w, client_t *c)
+{
+    for (;;) {
+        int want = 0;
+        ssize_t n;
+
+        switch (c->state) {
+        case C_IDLE:
+            // an idle keep-alive connection became readable: the server
+            // closed it, reconnect with the next request
+            if (c->fd >= 0) {
+                n = client_read(c, w->read_buf, READ_SIZE, &want);
+                if (n >= 0 || errno != EAGAIN)
+                    disconnect(w, c);
+            }
+            return;
+
+        case C_CONNECT: {
+            if (c->fd < 0) {
+                finish_request(w, c, 0);
+                return;
+            }
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if (err) {
+                finish_request(w, c, 0);
+                return;
+            }
+            struct sockaddr_in peer;
+            len = sizeof(peer);
+            if (getpeername(c->fd, (struct sockaddr *)&peer, &len) < 0) {
+                set_events(w, c, EPOLLOUT);
+                return;
+            }
+            c->state = c->ssl ? C_HANDSHAKE : C_WRITE;
+            break;
+        }
+
+        case C_HANDSHAKE: {
+            int ret = SSL_connect(c->ssl);
+            if (ret == 1) {
+                if (SSL_session_reused(c->ssl))
+                    w->resumed++;
+                c->state = C_WRITE;
+                break;
+            }
+            int err = SSL_get_error(c->ssl, ret);
+            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                set_events(w, c, err == SSL_ERROR_WANT_READ ? EPOLLIN : EPOLLOUT);
+                return;
+            }
+            finish_request(w, c, 0);
+            return;
+        }
+
+        case C_WRITE:
+            n = client_write(c, c->request + c->request_sent, c->request_len - c->request_sent, &want);
+            if (n < 0) {
+                if (errno == EAGAIN) {
+                    set_events(w, c, want);
+                    return;
+                }
+                finish_request(w, c, 0);
+                return;
+            }
+            c->request_sent += n;
+            if (c->request_sent == c->request_len) {
+                c->requests++;
+                c->state = C_READ;
+            }
+            break;
+
+        case C_READ:
+            if (c->status != 0 && c->body_left == 0) {
+                finish_request(w, c, 1);
+                return;
+            }
+            if (c->status == 0) {
+                // still collecting the headers
+                n = client_read(c, c->head + c->head_len, HEAD_SIZE - c->head_len, &want);
+            } else {
+                long left = c->body_left < 0 || c->body_left > READ_SIZE ? READ_SIZE : c->body_left;
+                n = client_read(c, w->read_buf, left, &want);
+            }
+            if (n < 0) {
+                if (errno == EAGAIN) {
+                    set_events(w, c, want);
+                    return;
+                }
+                finish_request(w, c, 0);
+                return;
+            }
+            if (n == 0) {
+                // a body without Content-Length ends with the connection,
+                // anything else closing early is a failure
+                c->server_close = 1;
+                finish_request(w, c, c->status != 0 && c->body_left < 0);
+                return;
+            }
+            if (c->bytes == 0)
+                c->first_byte = now_nsec();
+            c->bytes += n;
+            if (c->status == 0) {
+                c->head_len += n;
+                c->head[c->head_len] = '\0';
+                if (parse_head(c) < 0) {
+                    finish_request(w, c, 0);
+                    return;
+                }
+            } else if (c->body_left > 0) {
+                c->body_left -= n;
+            }
+            break;
+        }
+    }
+}
+
+// give due requests to free connections of their target
+static void dispatch(worker_t *w, long now)
+{
+    for (int t = 0; t < NTARGETS; t++) {
+        if (config.rate == 0) {
+            // closed-loop: a free connection sends right away, one that
+            // failed at once waits for the next round
+            for (int n = w->nidle[t]; n > 0 && now < measure_end; n--) {
+                client_t *c = &w->clients[w->idle[t][--w->nidle[t]]];
+                start_request(w, c, pick_kind(w, t), now);
+                step(w, c);
+            }
+            continue;
+        }
+        while (w->nidle[t] > 0 && w->head[t] != w->tail[t]) {
+            pending_t *p = &w->pending[t][w->head[t]++ % MAX_PENDING];
+            client_t *c = &w->clients[w->idle[t][--w->nidle[t]]];
+            start_request(w, c, p->kind, p->due);
+            step(w, c);
+        }
+    }
+}
+
+// queue the requests that became due since the last call, returns when the
+// next one is due
+static long schedule(worker_t *w, long *next_due, long now)
+{
+    long interval = 1e9 / w->rate;
+    while (*next_due <= now && *next_due < measure_end) {
+        int kind = pick_kind(w, -1);
+        int t = kind_target(kind);
+        if (w->tail[t] - w->head[t] < MAX_PENDING)
+            w->pending[t][w->tail[t]++ % MAX_PENDING] = (pending_t){ *next_due, kind };
+        else if (*next_due >= measure_start)
+            w->dropped++;
+        *next_due += interval;
+    }
+    return *next_due;
+}
+
+// fail requests that took longer than the timeout
+static void expire(worker_t *w, long now)
+{
+    long timeout = config.timeout * 1e9;
+    for (int i = 0; i < w->nclients; i++) {
+        client_t *c = &w->clients[i];
+        if (c->state != C_IDLE && now - c->start > timeout) {
+            c->server_close = 1;
+            finish_request(w, c, 0);
+        }
+    }
+}
+
+static void *worker_thread(void *arg)
+{
+    worker_t *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+    long next_due = now_nsec();
+    long last_expire = next_due;
+
+    for (;;) {
+        // after the window, wait for the requests still in flight
+        long now = now_nsec();
+        if (now >= measure_end && (w->busy == 0 || now >= measure_end + config.timeout * 1e9))
+            break;
+
+        long wait = 100000000;          // 100ms
+        if (config.rate > 0) {
+            long due = schedule(w, &next_due, now);
+            if (due - now < wait)
+                wait = due - now > 0 ? due - now : 0;
+        }
+        dispatch(w, now);
+        // closed-loop: a connection whose request already completed within
+        // dispatch() goes again on the next round instead of after the wait
+        if (config.rate == 0 && w->nidle[TARGET_FILES] + w->nidle[TARGET_REDIRECT] > 0)
+            wait = 0;
+
+        struct timespec ts = { wait / 1000000000, wait % 1000000000 };
+        int n = epoll_pwait2(w->epfd, events, MAX_EVENTS, &ts, NULL);
+        for (int i = 0; i < n; i++)
+            step(w, events[i].data.ptr);
+
+        now = now_nsec();
+        if (now - last_expire > 100000000) {
+            expire(w, now);
+            last_expire = now;
+        }
+    }
+
+    for (int i = 0; i < w->nclients; i++) {
+        disconnect(w, &w->clients[i]);
+        if (w->clients[i].session)
+            SSL_SESSION_free(w->clients[i].session);
+    }
+    return NULL;
+}
+
+static void init_worker(worker_t *w, int id, int nclients, int nredirect)
+{
+    w->epfd = epoll_create1(0);
+    w->nclients = nclients;
+    w->clients = calloc(nclients, sizeof(client_t));
+    w->read_buf = malloc(READ_SIZE);
+    w->seed = 0x9e3779b97f4a7c15UL * (id + 1);
+    w->rate = config.rate / config.threads;
+
+    for (int t = 0; t < NTARGETS; t++) {
+        w->idle[t] = calloc(nclients, sizeof(int));
+        w->pending[t] = config.rate > 0 ? calloc(MAX_PENDING, sizeof(pending_t)) : NULL;
+    }
+
+    for (int i = 0; i < nclients; i++) {
+        client_t *c = &w->clients[i];
+        c->fd = -1;
+        c->target = i < nredirect ? TARGET_REDIRECT : TARGET_FILES;
+        w->idle[c->target][w->nidle[c->target]++] = i;
+    }
+}
+
+// connects are only known for all kinds together, the other rows leave them out
+static void print_row(const char *kind, kind_stats_t *stats, double seconds, const char *connects)
+{
+    hist_t *hist = &stats->hist;
+    printf("%s,%s,%d,%s,%d,%.0f,%.1f,%s,%lu,%lu,%.1f,%.2f,%.1f,%.1f,%.1f,%.1f,%.1f,%s,%.1f,%.1f,%lu\n",
+            config.label, config.tls ? "https" : "http", config.keep_alive,
+            config.rate > 0 ? "open" : "closed", config.concurrency, config.rate, seconds,
+            kind, hist->total, stats->errors, hist->total / seconds,
+            stats->bytes / seconds / (1 << 20),
+            hist_percentile(hist, 50) / 1e3, hist_percentile(hist, 90) / 1e3,
+            hist_percentile(hist, 99) / 1e3, hist_percentile(hist, 99.9) / 1e3,
+            hist->max / 1e3, connects,
+            hist_percentile(&stats->ttfb, 50) / 1e3, hist_percentile(&stats->ttfb, 99) / 1e3, stats->shed);
+}
+
+static void report(worker_t *workers)
+{
+    static kind_stats_t kinds[NKINDS], all;
+    unsigned long connects = 0, resumed = 0, dropped = 0;
+    double seconds = config.duration;
+
+    for (int i = 0; i < config.threads; i++) {
+        for (int k = 0; k < NKINDS; k++) {
+            hist_merge(&kinds[k].hist, &workers[i].stats[k].hist);
+            hist_merge(&kinds[k].ttfb, &workers[i].stats[k].ttfb);
+            kinds[k].errors += workers[i].stats[k].errors;
+            kinds[k].shed += workers[i].stats[k].shed;
+            kinds[k].bytes += workers[i].stats[k].bytes;
+        }
+        connects += workers[i].connects;
+        resumed += workers[i].resumed;
+        dropped += workers[i].dropped;
+    }
+    for (int k = 0; k < NKINDS; k++) {
+        hist_merge(&all.hist, &kinds[k].hist);
+        hist_merge(&all.ttfb, &kinds[k].ttfb);
+        all.errors += kinds[k].errors;
+        all.shed += kinds[k].shed;
+        all.bytes += kinds[k].bytes;
+    }
+    all.errors += dropped;
+
+    if (config.header)
+        printf("label,scheme,keepalive,mode,concurrency,rate,seconds,kind,requests,errors,"
+               "req_per_s,mb_per_s,p50_us,p90_us,p99_us,p999_us,max_us,connects,ttfb_p50_us,ttfb_p99_us,shed\n");
+    for (int k = 0; k < NKINDS; k++) {
+        if (config.weights[k])
+            print_row(kind_names[k], &kinds[k], seconds, "");
+    }
+    char count[32];
+    snprintf(count, sizeof(count), "%lu", connects);
+    print_row("all", &all, seconds, count);
+
+    if (config.tls)
+        fprintf(stderr, "%lu connections, %lu resumed tls sessions\n", connects, resumed);
+    if (dropped)
+        fprintf(stderr, "%lu due requests dropped, the pending queue was full\n", dropped);
+}
+
+static struct {
+    pthread_t thread;
+    unsigned long connects;
+    unsigned long closed;               // by the server
+    unsigned long held;                 // sum of the per-second samples
+    unsigned long samples;
+} slow;
+
+static int slow_connect(int epfd, int i)
+{
+    struct sockaddr_in addr = config.addr;
+    addr.sin_port = htons(config.port);
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.u32 = i };
+    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+    slow.connects++;
+    return fd;
+}
+
+// keeps the slowloris connections open until the measurement ends
+static void *slow_thread(void *arg)
+{
+    int n = config.slow_conns;
+    int *fds = malloc(n * sizeof(int));
+    int *lines = calloc(n, sizeof(int));    // header lines sent on each
+    int epfd = epoll_create1(0);
+    struct epoll_event events[MAX_EVENTS];
+    char buf[256];
+
+    for (int i = 0; i < n; i++)
+        fds[i] = slow_connect(epfd, i);
+
+    long interval = config.slow_interval * 1e9;
+    long next_line = now_nsec(), next_sample = now_nsec() + 1000000000L;
+    while (now_nsec() < measure_end) {
+        long now = now_nsec();
+        if (now >= next_line) {
+            // a request line first, then one header after another, the
+            // blank line never comes
+            for (int i = 0; i < n; i++) {
+                if (fds[i] < 0 && (fds[i] = slow_connect(epfd, i)) < 0)
+                    continue;
+                if (config.tls)
+                    continue;
+                int len = lines[i] == 0 ? snprintf(buf, sizeof(buf), "GET / HTTP/1.1\r\nHost: %s\r\n", config.host)
+                                        : snprintf(buf, sizeof(buf), "X-%d: %d\r\n", lines[i], lines[i]);
+                if (send(fds[i], buf, len, MSG_NOSIGNAL) == len)
+                    lines[i]++;
+            }
+            next_line += interval;
+        }
+        if (now >= next_sample) {
+            int held = 0;
+            for (int i = 0; i < n; i++)
+                held += fds[i] >= 0;
+            if (now >= measure_start) {
+                slow.held += held;
+                slow.samples++;
+            }
+            next_sample += 1000000000L;
+        }
+
+        int ready = epoll_wait(epfd, events, MAX_EVENTS, 100);
+        for (int e = 0; e < ready; e++) {
+            int i = events[e].data.u32;
+            if (fds[i] < 0)
+                continue;
+            ssize_t r = recv(fds[i], buf, sizeof(buf), 0);
+            if (r > 0 || (r < 0 && errno == EAGAIN))
+                continue;
+            // the server gave up on it, come back with a new one
+            close(fds[i]);
+            slow.closed++;
+            lines[i] = 0;
+            fds[i] = slow_connect(epfd, i);
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    close(epfd);
+    free(fds);
+    free(lines);
+    return NULL;
+}
+
+// parse a mix like 200=80,206=10,301=5,404=5
+static int parse_mix(const char *mix)
+{
+    memset(config.weights, 0, sizeof(config.weights));
+    for (const char *p = mix; *p; ) {
+        int k;
+        for (k = 0; k < NKINDS; k++) {
+            if (strncmp(p, kind_names[k], 3) == 0 && p[3] == '=')
+                break;
+        }
+        if (k == NKINDS)
+            return -1;
+        char *end;
+        config.weights[k] = strtol(p + 4, &end, 10);
+        if (end == p + 4 || config.weights[k] < 0 || (*end != ',' && *end != '\0'))
+            return -1;
+        p = *end ? end + 1 : end;
+    }
+    int total = 0;
+    for (int k = 0; k < NKINDS; k++)
+        total += config.weights[k];
+    return total > 0 ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [options]\n"
+            "  -H, --host ADDR     server ipv4 address (default: 127.0.0.1)\n"
+            "  -p, --port N        port of the file requests (default: 443)\n"
+            "      --redirect-port N\n"
+            "                      port the 301 requests go to, in plaintext (default: 80)\n"
+            "  -s, --tls           use https for the file requests\n"
+            "      --no-resume     do a full handshake on every tls connection\n"
+            "  -k, --keepalive     send many requests per connection\n"
+            "  -c, --concurrency N connections, in open-loop mode the most that are used (default: 64)\n"
+            "  -t, --threads N     threads, connections are split among them (default: 1)\n"
+            "  -r, --rate N        open-loop: send N requests per second in total, latency\n"
+            "                      counts from when a request was due (default: 0, closed-loop)\n"
+            "  -d, --duration N    seconds measured (default: 10)\n"
+            "  -W, --warmup N      seconds run before measuring (default: 1)\n"
+            "  -T, --timeout N     seconds before a request counts as failed (default: 5)\n"
+            "  -m, --mix MIX       weights of the kinds of requests, e.g. 200=80,206=10,301=5,404=5\n"
+            "                      (default: 200=100)\n"
+            "  -u, --url PATH      file the 200 and 206 requests ask for (default: /index.html)\n"
+            "      --range SPEC    byte range of the 206 requests (default: 0-1023)\n"
+            "  -l, --label TEXT    first CSV column, e.g. the commit being measured\n"
+            "      --slowloris N   also hold N connections that send a header line per interval\n"
+            "                      and never finish their request, or never handshake with --tls\n"
+            "      --slow-interval N\n"
+            "                      seconds between the header lines of those (default: 1)\n"
+            "      --no-header     leave out the CSV header line, for appending\n"
+            "  -h, --help          show this help\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option options[] = {
+        { "host",           required_argument, NULL, 'H' },
+        { "port",           required_argument, NULL, 'p' },
+        { "redirect-port",  required_argument, NULL, 'R' },
+        { "tls",            no_argument,       NULL, 's' },
+        { "no-resume",      no_argument,       NULL, 'N' },
+        { "keepalive",      no_argument,       NULL, 'k' },
+        { "concurrency",    required_argument, NULL, 'c' },
+        { "threads",        required_argument, NULL, 't' },
+        { "rate",           required_argument, NULL, 'r' },
+        { "duration",       required_argument, NULL, 'd' },
+        { "warmup",         required_argument, NULL, 'W' },
+        { "timeout",        required_argument, NULL, 'T' },
+        { "mix",            required_argument, NULL, 'm' },
+        { "url",            required_argument, NULL, 'u' },
+        { "range",          required_argument, NULL, 'g' },
+        { "label",          required_argument, NULL, 'l' },
+        { "no-header",      no_argument,       NULL, 'n' },
+        { "slowloris",      required_argument, NULL, 'S' },
+        { "slow-interval",  required_argument, NULL, 'I' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "H:p:skc:t:r:d:W:T:m:u:l:h", options, NULL)) != -1) {
+        switch (opt) {
+            case 'H':
+                config.host = optarg;
+                break;
+            case 'p':
+                config.port = atoi(optarg);
+                break;
+            case 'R':
+                config.redirect_port = atoi(optarg);
+                break;
+            case 's':
+                config.tls = 1;
+                break;
+            case 'N':
+                config.resume = 0;
+                break;
+            case 'k':
+                config.keep_alive = 1;
+                break;
+            case 'c':
+                config.concurrency = atoi(optarg);
+                break;
+            case 't':
+                config.threads = atoi(optarg);
+                break;
+            case 'r':
+                config.rate = atof(optarg);
+                break;
+            case 'd':
+                config.duration = atof(optarg);
+                break;
+            case 'W':
+                config.warmup = atof(optarg);
+                break;
+            case 'T':
+                config.timeout = atof(optarg);
+                break;
+            case 'm':
+                if (parse_mix(optarg) < 0) {
+                    fprintf(stderr, "invalid mix: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'u':
+                config.url = optarg;
+                break;
+            case 'g':
+                config.range = optarg;
+                break;
+            case 'l':
+                config.label = optarg;
+                break;
+            case 'n':
+                config.header = 0;
+                break;
+            case 'S':
+                config.slow_conns = atoi(optarg);
+                break;
+            case 'I':
+                config.slow_interval = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? 0 : 1);
+        }
+    }
+
+    config.addr.sin_family = AF_INET;
+    if (inet_pton(AF_INET, config.host, &config.addr.sin_addr) != 1) {
+        fprintf(stderr, "invalid host: %s\n", config.host);
+        exit(1);
+    }
+    if (config.threads < 1 || config.concurrency < config.threads || config.duration <= 0) {
+        fprintf(stderr, "need at least one connection per thread and a positive duration\n");
+        exit(1);
+    }
+
+    // openssl writes to sockets the server may have closed already
+    signal(SIGPIPE, SIG_IGN);
+
+    if (config.tls) {
+        ssl_ctx = SSL_CTX_new(TLS_client_method());
+        SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_NONE, NULL);
+        SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT);
+    }
+
+    // redirect connections get the share of the mix that goes to them, at
+    // least one per thread if there are any
+    int total = 0;
+    for (int k = 0; k < NKINDS; k++)
+        total += config.weights[k];
+    int per_thread = config.concurrency / config.threads;
+    int nredirect = (long)per_thread * config.weights[KIND_301] / total;
+    if (config.weights[KIND_301] && nredirect == 0)
+        nredirect = 1;
+    if (config.weights[KIND_301] < total && nredirect == per_thread)
+        nredirect = per_thread - 1;
+    if (nredirect < 0 || (nredirect == per_thread && config.weights[KIND_301] < total)) {
+        fprintf(stderr, "too few connections for the mix\n");
+        exit(1);
+    }
+
+    long start = now_nsec();
+    measure_start = start + config.warmup * 1e9;
+    measure_end = measure_start + config.duration * 1e9;
+
+    if (config.slow_conns > 0 && pthread_create(&slow.thread, NULL, slow_thread, NULL)) {
+        perror("create thread");
+        exit(1);
+    }
+
+    worker_t *workers = calloc(config.threads, sizeof(worker_t));
+    for (int i = 0; i < config.threads; i++) {
+        int nclients = per_thread + (i < config.concurrency % config.threads);
+        init_worker(&workers[i], i, nclients, nredirect);
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i])) {
+            perror("create thread");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < config.threads; i++)
+        pthread_join(workers[i].thread, NULL);
+    if (config.slow_conns > 0) {
+        pthread_join(slow.thread, NULL);
+        fprintf(stderr, "slowloris: %lu of %d connections held on average, %lu closed by the server, %lu connects\n",
+                slow.samples ? slow.held / slow.samples : 0, config.slow_conns, slow.closed, slow.connects);
+    }
+
+    report(workers);
+    return 0;
+}
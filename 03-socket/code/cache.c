@@ -0,0 +1,446 @@
+#include "cache.h"
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE \
+        | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+static cache_t cache;
+
+static int inotify_fd = -1;
+static const char *docroot;
+static char **watch_urls;               // url of the directory behind each watch
+static int nwatch_urls;
+static pthread_t watch_thread;
+
+// FNV-1a
+static unsigned hash_url(const char *url)
+{
+    unsigned hash = 2166136261u;
+    for (; *url; url++) {
+        hash ^= (unsigned char)*url;
+        hash *= 16777619u;
+    }
+    return hash % CACHE_BUCKETS;
+}
+
+static cache_entry_t *find_entry(const char *url)
+{
+    cache_entry_t *entry;
+    list_for_each_entry(entry, &cache.hash_table[hash_url(url)], hash_list) {
+        if (strcmp(entry->url, url) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+static void free_entry(cache_entry_t *entry)
+{
+    free(entry->url);
+    free(entry->data);
+    free(entry->gzip);
+    free(entry);
+}
+
+// take the entry out of the table, it is freed once the last connection
+// sending it lets go, called with the lock held
+static void unlink_entry(cache_entry_t *entry)
+{
+    list_delete_entry(&entry->hash_list);
+    list_delete_entry(&entry->lru_list);
+    entry->linked = 0;
+    cache.resident -= entry->size;
+    cache.entries--;
+    if (entry->gzip) {
+        cache.gzip_resident -= entry->gzip_size;
+        cache.gzip_copies--;
+    }
+    if (entry->refs == 0)
+        free_entry(entry);
+}
+
+// look up a cached file, the current generation is returned so that after a
+// miss a later cache_load() can tell whether the file changed in between
+cache_entry_t *cache_lookup(const char *url, unsigned long *generation)
+{
+    *generation = 0;
+    if (cache.capacity == 0)
+        return NULL;
+
+    pthread_mutex_lock(&cache.lock);
+    cache_entry_t *entry = find_entry(url);
+    *generation = cache.generation;
+    if (entry) {
+        list_delete_entry(&entry->lru_list);
+        list_add_head(&entry->lru_list, &cache.lru);
+        entry->refs++;
+        cache.hits++;
+    } else {
+        cache.misses++;
+    }
+    pthread_mutex_unlock(&cache.lock);
+
+    return entry;
+}
+
+// read the file into a new entry and insert it, evicting the least recently
+// used entries to make room. Returns a referenced entry, or NULL if the file
+// should not or could not be cached.
+cache_entry_t *cache_load(const char *url, int fd, const struct stat *st, unsigned long generation)
+{
+    off_t size = st->st_size;
+
+    if (cache.capacity == 0 || size > cache.max_entry || size > cache.capacity)
+        return NULL;
+
+    cache_entry_t *entry = calloc(1, sizeof(cache_entry_t));
+    if (entry == NULL)
+        return NULL;
+    entry->url = strdup(url);
+    entry->data = malloc(size > 0 ? size : 1);
+    entry->size = size;
+    entry->ino = st->st_ino;
+    entry->mtime = st->st_mtim.tv_sec;
+    entry->mtime_nsec = st->st_mtim.tv_nsec;
+    if (entry->url == NULL || entry->data == NULL) {
+        free_entry(entry);
+        return NULL;
+    }
+
+    for (off_t done = 0; done < size; ) {
+        ssize_t n = pread(fd, entry->data + done, size - done, done);
+        if (n <= 0) {
+            free_entry(entry);
+            return NULL;
+        }
+        done += n;
+    }
+    entry->header_len = snprintf(entry->header, CACHE_HEADER_SIZE,
+            "Content-Length: %lld\r\n", (long long)size);
+    entry->refs = 1;
+
+    pthread_mutex_lock(&cache.lock);
+
+    // the file was modified while being read, do not cache what we got
+    if (generation != cache.generation) {
+        pthread_mutex_unlock(&cache.lock);
+        free_entry(entry);
+        return NULL;
+    }
+
+    // another worker loaded it first
+    cache_entry_t *existing = find_entry(url);
+    if (existing) {
+        existing->refs++;
+        pthread_mutex_unlock(&cache.lock);
+        free_entry(entry);
+        return existing;
+    }
+
+    while (cache.resident + size > cache.capacity && !list_empty(&cache.lru)) {
+        unlink_entry(list_entry(cache.lru.prev, cache_entry_t, lru_list));
+        cache.evictions++;
+    }
+
+    list_add_head(&entry->hash_list, &cache.hash_table[hash_url(url)]);
+    list_add_head(&entry->lru_list, &cache.lru);
+    entry->linked = 1;
+    cache.resident += size;
+    cache.entries++;
+
+    pthread_mutex_unlock(&cache.lock);
+
+    return entry;
+}
+
+// drop gzip copies, least recently used first, until size more bytes fit.
+// Copies of entries being sent are left alone. Called with the lock held.
+static int make_gzip_room(off_t size)
+{
+    cache_entry_t *entry;
+    list_for_each_entry_reverse(entry, &cache.lru, lru_list) {
+        if (cache.gzip_resident + size <= cache.gzip_capacity)
+            break;
+        if (entry->gzip == NULL || entry->refs > 0)
+            continue;
+        cache.gzip_resident -= entry->gzip_size;
+        cache.gzip_copies--;
+        free(entry->gzip);
+        entry->gzip = NULL;
+        entry->gzip_size = 0;
+    }
+    return cache.gzip_resident + size <= cache.gzip_capacity;
+}
+
+// make sure the referenced entry has a gzip copy, compressing the file the
+// first time. Returns 0 if entry->gzip can be sent, -1 if there is no copy:
+// gzip copies are disabled, the file does not shrink or the copy does not fit.
+int cache_gzip(cache_entry_t *entry)
+{
+    // set under the lock and only dropped while no one refers to the entry
+    if (__atomic_load_n(&entry->gzip, __ATOMIC_ACQUIRE))
+        return 0;
+    if (cache.gzip_capacity == 0 || entry->gzip_useless || entry->size < GZIP_MIN_SIZE)
+        return -1;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    uLong bound = deflateBound(&zs, entry->size);
+    char *out = malloc(bound);
+    zs.next_in = (Bytef *)entry->data;
+    zs.avail_in = entry->size;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = bound;
+    int ret = out ? deflate(&zs, Z_FINISH) : Z_MEM_ERROR;
+    off_t out_size = zs.total_out;
+    deflateEnd(&zs);
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+    long usec = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000;
+    if (ret != Z_STREAM_END) {
+        free(out);
+        return -1;
+    }
+
+    pthread_mutex_lock(&cache.lock);
+    cache.compressions++;
+    cache.compressed_in += entry->size;
+    cache.compressed_out += out_size;
+    cache.compress_usec += usec;
+
+    // another worker got there first
+    if (entry->gzip) {
+        pthread_mutex_unlock(&cache.lock);
+        free(out);
+        return 0;
+    }
+    if (out_size >= entry->size)
+        entry->gzip_useless = 1;
+    if (!entry->linked || entry->gzip_useless || !make_gzip_room(out_size)) {
+        pthread_mutex_unlock(&cache.lock);
+        free(out);
+        return -1;
+    }
+
+    char *shrunk = realloc(out, out_size);
+    entry->gzip_size = out_size;
+    __atomic_store_n(&entry->gzip, shrunk ? shrunk : out, __ATOMIC_RELEASE);
+    cache.gzip_resident += out_size;
+    cache.gzip_copies++;
+    pthread_mutex_unlock(&cache.lock);
+
+    return 0;
+}
+
+void cache_count_encoded(off_t identity_size, off_t encoded_size)
+{
+    __atomic_add_fetch(&cache.encoded_responses, 1, __ATOMIC_RELAXED);
+    if (encoded_size < identity_size)
+        __atomic_add_fetch(&cache.encoded_saved, identity_size - encoded_size, __ATOMIC_RELAXED);
+}
+
+void cache_count_not_modified(off_t size)
+{
+    __atomic_add_fetch(&cache.not_modified, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&cache.not_modified_saved, size, __ATOMIC_RELAXED);
+}
+
+void cache_release(cache_entry_t *entry)
+{
+    pthread_mutex_lock(&cache.lock);
+    if (--entry->refs == 0 && !entry->linked)
+        free_entry(entry);
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// drop the entry of url, or with prefix set every entry at or below the
+// directory url ("" drops everything)
+void cache_invalidate(const char *url, int prefix)
+{
+    pthread_mutex_lock(&cache.lock);
+    cache.generation++;
+
+    if (!prefix) {
+        cache_entry_t *entry = find_entry(url);
+        if (entry) {
+            unlink_entry(entry);
+            cache.invalidations++;
+        }
+
+        // the file of a sidecar remembers it had none, forget that as well
+        int len = strlen(url);
+        if (len > 3 && (strcmp(url + len - 3, ".gz") == 0 || strcmp(url + len - 3, ".br") == 0)) {
+            char base[PATH_MAX];
+            snprintf(base, sizeof(base), "%.*s", len - 3, url);
+            if ((entry = find_entry(base)) != NULL) {
+                unlink_entry(entry);
+                cache.invalidations++;
+            }
+        }
+    } else {
+        int len = strlen(url);
+        cache_entry_t *entry, *q;
+        list_for_each_entry_safe(entry, q, &cache.lru, lru_list) {
+            if (strncmp(entry->url, url, len) == 0
+                    && (entry->url[len] == '/' || entry->url[len] == '\0')) {
+                unlink_entry(entry);
+                cache.invalidations++;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&cache.lock);
+}
+
+// watch the directory and everything below it, url is how the directory
+// appears in request urls ("" for the docroot)
+static void watch_dir(const char *path, const char *url)
+{
+    int wd = inotify_add_watch(inotify_fd, path, WATCH_MASK);
+    if (wd < 0) {
+        perror("inotify_add_watch failed");
+        return;
+    }
+    if (wd >= nwatch_urls) {
+        int n = wd * 2 + 16;
+        watch_urls = realloc(watch_urls, n * sizeof(char *));
+        memset(watch_urls + nwatch_urls, 0, (n - nwatch_urls) * sizeof(char *));
+        nwatch_urls = n;
+    }
+    free(watch_urls[wd]);
+    watch_urls[wd] = strdup(url);
+
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return;
+
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (de->d_type != DT_DIR || strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        char sub_path[PATH_MAX], sub_url[PATH_MAX];
+        snprintf(sub_path, sizeof(sub_path), "%s/%s", path, de->d_name);
+        snprintf(sub_url, sizeof(sub_url), "%s/%s", url, de->d_name);
+        watch_dir(sub_path, sub_url);
+    }
+    closedir(dir);
+}
+
+// turn inotify events on the docroot into invalidations, so edits show up
+// on the next request
+static void *watch_docroot_thread(void *arg)
+{
+    char buf[64 << 10] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            perror("read inotify failed");
+            continue;
+        }
+
+        for (char *p = buf; p < buf + len; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                // events were lost, nothing in the cache can be trusted
+                cache_invalidate("", 1);
+                continue;
+            }
+            if (ev->wd < 0 || ev->wd >= nwatch_urls || watch_urls[ev->wd] == NULL)
+                continue;
+
+            if (ev->mask & IN_IGNORED) {
+                free(watch_urls[ev->wd]);
+                watch_urls[ev->wd] = NULL;
+                continue;
+            }
+            if (ev->len == 0)
+                continue;
+
+            char url[PATH_MAX];
+            snprintf(url, sizeof(url), "%s/%s", watch_urls[ev->wd], ev->name);
+
+            if (ev->mask & IN_ISDIR) {
+                cache_invalidate(url, 1);
+                if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    char path[PATH_MAX];
+                    snprintf(path, sizeof(path), "%s%s", docroot, url);
+                    watch_dir(path, url);
+                }
+            } else {
+                cache_invalidate(url, 0);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// a capacity of 0 disables the cache, so does a docroot that cannot be
+// watched since stale entries could then be served forever
+int init_cache(long capacity, long max_entry, long gzip_capacity, const char *root)
+{
+    bzero(&cache, sizeof(cache_t));
+    for (int i = 0; i < CACHE_BUCKETS; i++)
+        init_list_head(&cache.hash_table[i]);
+    init_list_head(&cache.lru);
+    pthread_mutex_init(&cache.lock, NULL);
+
+    if (capacity <= 0)
+        return 0;
+
+    docroot = root;
+    inotify_fd = inotify_init1(IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        perror("inotify_init failed, cache disabled");
+        return -1;
+    }
+    watch_dir(docroot, "");
+
+    if (pthread_create(&watch_thread, NULL, watch_docroot_thread, NULL)) {
+        perror("creat inotify thread error, cache disabled");
+        return -1;
+    }
+
+    cache.max_entry = max_entry;
+    cache.capacity = capacity;
+    cache.gzip_capacity = gzip_capacity;
+
+    return 0;
+}
+
+void dump_cache_stats()
+{
+    pthread_mutex_lock(&cache.lock);
+    unsigned long lookups = cache.hits + cache.misses;
+    fprintf(stderr, "cache: %lu entries, %ld/%ld bytes resident, hit ratio %.1f%% (%lu/%lu), "
+            "%lu evictions, %lu invalidations\n",
+            cache.entries, cache.resident, cache.capacity,
+            lookups ? 100.0 * cache.hits / lookups : 0.0, cache.hits, lookups,
+            cache.evictions, cache.invalidations);
+    fprintf(stderr, "gzip: %lu copies, %ld/%ld bytes resident, %lu compressions %lu -> %lu bytes "
+            "in %.1f ms cpu, %lu encoded responses saved %lu bytes\n",
+            cache.gzip_copies, cache.gzip_resident, cache.gzip_capacity, cache.compressions,
+            cache.compressed_in, cache.compressed_out, cache.compress_usec / 1000.0,
+            __atomic_load_n(&cache.encoded_responses, __ATOMIC_RELAXED),
+            __atomic_load_n(&cache.encoded_saved, __ATOMIC_RELAXED));
+    fprintf(stderr, "conditional: %lu not modified responses saved %lu bytes\n",
+            __atomic_load_n(&cache.not_modified, __ATOMIC_RELAXED),
+            __atomic_load_n(&cache.not_modified_saved, __ATOMIC_RELAXED));
+    pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,926 @@
+#include "admission.h"
+#include "cache.h"
+#include "config.h"
+#include "event.h"
+#include "h2.h"
+#include "http.h"
+#include "tls.h"
+#include "upload.h"
+#include "uring.h"
+#include "worker.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static long now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+static long now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+// the latency profile: a returning client may carry its request in the SYN
+// (TCP Fast Open), and a connection is only handed to accept() once its first
+// bytes are in, so the worker never wakes up for a socket with nothing to read
+static void set_low_latency(int sock)
+{
+    int qlen = config.backlog;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) < 0)
+        perror("setsockopt(TCP_FASTOPEN) failed");
+    int seconds = config.header_timeout;
+    if (setsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, &seconds, sizeof(seconds)) < 0)
+        perror("setsockopt(TCP_DEFER_ACCEPT) failed");
+}
+
+static void open_listener(event_loop_t *loop, int port, int role)
+{
+    listener_t *listener = &loop->listeners[loop->nlisteners++];
+
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (sock < 0) {
+        perror("Opening socket failed");
+        exit(1);
+    }
+    int enable = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0) {
+        perror("setsockopt(SO_REUSEADDR) failed");
+        exit(1);
+    }
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(int)) < 0) {
+        perror("setsockopt(SO_REUSEPORT) failed");
+        exit(1);
+    }
+
+    struct sockaddr_in addr;
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("Bind failed");
+        exit(1);
+    }
+    if (listen(sock, config.backlog) < 0) {
+        perror("Listen failed");
+        exit(1);
+    }
+    if (config.low_latency)
+        set_low_latency(sock);
+
+    listener->type = EV_LISTENER;
+    listener->fd = sock;
+    listener->port = port;
+    listener->role = role;
+
+    // the io_uring engine accepts through the ring instead
+    if (loop->ring)
+        return;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = listener;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+        perror("epoll_ctl failed");
+        exit(1);
+    }
+}
+
+static void init_handoff(event_loop_t *loop)
+{
+    handoff_t *handoff = &loop->handoff;
+    handoff->type = EV_HANDOFF;
+
+    // the ring waits in a read, which must block rather than fail
+    handoff->fd = eventfd(0, EFD_CLOEXEC | (loop->ring ? 0 : EFD_NONBLOCK));
+    if (handoff->fd < 0) {
+        perror("eventfd failed");
+        exit(1);
+    }
+    if (loop->ring)
+        return;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = handoff;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, handoff->fd, &ev) < 0) {
+        perror("epoll_ctl failed");
+        exit(1);
+    }
+}
+
+void init_event_loop(event_loop_t *loop)
+{
+    bzero(loop, sizeof(event_loop_t));
+
+    loop->epfd = epoll_create1(0);
+    if (loop->epfd < 0) {
+        perror("epoll_create failed");
+        exit(1);
+    }
+    init_wheel(&loop->timers, now_sec());
+
+    if (config.access_log)
+        loop->log = new_log_ring();
+
+    if (config.engine == ENGINE_URING && init_uring(loop) < 0)
+        fprintf(stderr, "io_uring unavailable, falling back to epoll\n");
+
+    // port 80 serves files itself when it is configured as the plaintext port
+    if (config.plain_port == HTTP_PORT) {
+        open_listener(loop, HTTP_PORT, SERVE_PLAIN);
+    } else {
+        open_listener(loop, HTTP_PORT, SERVE_REDIRECT);
+        if (config.plain_port)
+            open_listener(loop, config.plain_port, SERVE_PLAIN);
+    }
+    // with a handshake pool the https port is the pool's, connections
+    // come in through the handoff stack once their handshake is done
+    if (config.handshake_threads > 0)
+        init_handoff(loop);
+    else
+        open_listener(loop, HTTPS_PORT, SERVE_TLS);
+    if (config.admin_port)
+        open_listener(loop, config.admin_port, SERVE_ADMIN);
+}
+
+// a handshake thread only accepts on the https port and runs handshakes
+void init_handshake_loop(event_loop_t *loop)
+{
+    bzero(loop, sizeof(event_loop_t));
+
+    loop->epfd = epoll_create1(0);
+    if (loop->epfd < 0) {
+        perror("epoll_create failed");
+        exit(1);
+    }
+    init_wheel(&loop->timers, now_sec());
+    loop->handshake_only = 1;
+    open_listener(loop, HTTPS_PORT, SERVE_TLS);
+}
+
+// a connection has one deadline at a time, each state re-arms it: the
+// handshake, the header block of a request, every piece of the response and
+// the wait for the next request all have to be done in time
+static void set_deadline(event_loop_t *loop, conn_t *conn, int seconds)
+{
+    arm_timer(&loop->timers, &conn->timer, now_sec() + seconds);
+}
+
+static void start_idle(event_loop_t *loop, conn_t *conn)
+{
+    conn->idle = 1;
+    set_deadline(loop, conn, config.keepalive_timeout);
+}
+
+// the next request started coming in, it has to be complete in time no
+// matter how slowly it trickles
+void stop_idle(event_loop_t *loop, conn_t *conn)
+{
+    if (conn->idle) {
+        conn->idle = 0;
+        set_deadline(loop, conn, config.header_timeout);
+    }
+}
+
+// n bytes of the response went out, the client is keeping up
+void conn_sent(event_loop_t *loop, conn_t *conn, long n)
+{
+    stat_add(loop->metrics.bytes_sent, n);
+    conn->sent += n;
+    set_deadline(loop, conn, config.send_timeout);
+}
+
+// n bytes of a request body came in, the client is keeping up
+void conn_received(event_loop_t *loop, conn_t *conn, long n)
+{
+    stat_add(loop->metrics.bytes_received, n);
+    set_deadline(loop, conn, config.send_timeout);
+}
+
+// forget the response that was just sent, keeping the buffers
+static void reset_response(conn_t *conn)
+{
+    conn->response_len = 0;
+    conn->response_sent = 0;
+
+    if (conn->file_fd >= 0)
+        close(conn->file_fd);
+    conn->file_fd = -1;
+    conn->file_offset = 0;
+    conn->file_left = 0;
+    conn->zero_copy = 0;
+    conn->buf_len = 0;
+    conn->buf_sent = 0;
+
+    if (conn->cache_entry)
+        cache_release(conn->cache_entry);
+    conn->cache_entry = NULL;
+    conn->cache_data = NULL;
+    conn->body = NULL;
+    conn->body_len = 0;
+    conn->body_sent = 0;
+    conn->file_size = 0;
+    conn->nranges = 0;
+    conn->next_range = 0;
+    conn->sent = 0;
+}
+
+void close_conn(event_loop_t *loop, conn_t *conn)
+{
+    cancel_timer(&loop->timers, &conn->timer);
+
+    // ring requests still refer to the connection, it is freed once the
+    // last of them has completed
+    if (conn->inflight > 0) {
+        cancel_conn_io(loop, conn);
+        return;
+    }
+    if (loop->ring)
+        release_conn_io(loop, conn);
+
+    // the error queue is per thread, whatever failed on this connection
+    // must not show up in SSL_get_error() of the next one
+    if (conn->ssl) {
+        SSL_shutdown(conn->ssl);
+        SSL_free(conn->ssl);
+        ERR_clear_error();
+    }
+    close(conn->fd);
+    if (conn->h2)
+        free_h2_session(conn->h2);
+    if (conn->upload)
+        free_upload(conn->upload);
+    if (conn->file_fd >= 0)
+        close(conn->file_fd);
+    free(conn->buf);
+    if (conn->cache_entry)
+        cache_release(conn->cache_entry);
+    release_admission(conn->client_slot);
+    free(conn);
+    stat_add(loop->nconns, -1);
+}
+
+// the result of SSL_read() or SSL_peek() in the convention of conn_read
+static int ssl_read_result(conn_t *conn, int n)
+{
+    if (n > 0)
+        return n;
+
+    switch (SSL_get_error(conn->ssl, n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        default:
+            errno = EIO;
+            return -1;
+    }
+}
+
+// read from the connection, returns the number of bytes read, 0 when the peer
+// closed the connection, or -1 with errno set (EAGAIN if it would block)
+int conn_read(conn_t *conn, char *buf, int len)
+{
+    if (conn->ssl == NULL)
+        return recv(conn->fd, buf, len, 0);
+    return ssl_read_result(conn, SSL_read(conn->ssl, buf, len));
+}
+
+// look at what conn_read would return without taking it
+int conn_peek(conn_t *conn, char *buf, int len)
+{
+    if (conn->ssl == NULL)
+        return recv(conn->fd, buf, len, MSG_PEEK);
+    return ssl_read_result(conn, SSL_peek(conn->ssl, buf, len));
+}
+
+// write to the connection, same return convention as conn_read
+int conn_write(conn_t *conn, const char *buf, int len)
+{
+    if (conn->ssl == NULL)
+        return send(conn->fd, buf, len, MSG_NOSIGNAL);
+
+    int n = SSL_write(conn->ssl, buf, len);
+    if (n > 0)
+        return n;
+
+    switch (SSL_get_error(conn->ssl, n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        default:
+            errno = EIO;
+            return -1;
+    }
+}
+
+// send the rest of the headers and account for them, same return convention
+// as conn_read. In plaintext an in-memory body goes along in the same
+// sendmsg(), and headers before a file body are held back with MSG_MORE so
+// they leave in one packet with its first bytes.
+static ssize_t write_header(conn_t *conn)
+{
+    struct iovec iov[2];
+    int iovcnt = 1;
+    ssize_t n;
+
+    iov[0].iov_base = conn->response + conn->response_sent;
+    iov[0].iov_len = conn->response_len - conn->response_sent;
+    if (conn->ssl) {
+        n = conn_write(conn, iov[0].iov_base, iov[0].iov_len);
+        if (n > 0)
+            conn->response_sent += n;
+        return n;
+    }
+
+    if (conn->body && conn->body_sent < conn->body_len) {
+        off_t count = conn->body_len - conn->body_sent;
+        iov[1].iov_base = (char *)conn->body + conn->body_sent;
+        iov[1].iov_len = count < BODY_CHUNK ? count : BODY_CHUNK;
+        iovcnt = 2;
+    }
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iovcnt };
+    n = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | (conn->file_left > 0 ? MSG_MORE : 0));
+    if (n <= 0)
+        return n;
+
+    if ((size_t)n <= iov[0].iov_len) {
+        conn->response_sent += n;
+    } else {
+        conn->response_sent = conn->response_len;
+        conn->body_sent += n - iov[0].iov_len;
+    }
+    return n;
+}
+
+// send up to count bytes of the body file, same return convention as conn_read
+static ssize_t conn_sendfile(conn_t *conn, size_t count)
+{
+    if (conn->ssl == NULL)
+        return sendfile(conn->fd, conn->file_fd, &conn->file_offset, count);
+
+    ossl_ssize_t n = SSL_sendfile(conn->ssl, conn->file_fd, conn->file_offset, count, 0);
+    if (n > 0) {
+        conn->file_offset += n;
+        return n;
+    }
+
+    switch (SSL_get_error(conn->ssl, n)) {
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        default:
+            errno = EIO;
+            return -1;
+    }
+}
+
+// read the next chunk of the body into the connection buffer, the buffer is
+// only allocated once the body has to pass through user space
+static int fill_body_buffer(conn_t *conn)
+{
+    if (conn->buf == NULL && (conn->buf = malloc(config.buffer_size)) == NULL)
+        return -1;
+
+    size_t count = conn->file_left < config.buffer_size ? conn->file_left : config.buffer_size;
+    ssize_t n = pread(conn->file_fd, conn->buf, count, conn->file_offset);
+    if (n <= 0)
+        return -1;
+
+    conn->file_offset += n;
+    conn->file_left -= n;
+    conn->buf_len = n;
+    conn->buf_sent = 0;
+
+    return 0;
+}
+
+// account the handshake and record which path the connection encrypts its
+// data on
+static void handshake_done(event_loop_t *loop, conn_t *conn)
+{
+    long usec = now_usec() - conn->accept_usec;
+    if (SSL_session_reused(conn->ssl)) {
+        stat_add(loop->resumed_handshakes, 1);
+        stat_add(loop->resumed_handshake_usec, usec);
+    } else {
+        stat_add(loop->full_handshakes, 1);
+        stat_add(loop->full_handshake_usec, usec);
+    }
+
+    conn->ktls = BIO_get_ktls_send(SSL_get_wbio(conn->ssl));
+    if (conn->ktls)
+        stat_add(loop->ktls_conns, 1);
+    else
+        stat_add(loop->user_tls_conns, 1);
+
+    if (config.verbose) {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &conn->addr.sin_addr, ip, sizeof(ip));
+        fprintf(stderr, "%s:%d %s %s, %s handshake in %ld us, tx path: %s\n", ip,
+                ntohs(conn->addr.sin_port), SSL_get_version(conn->ssl),
+                SSL_get_cipher_name(conn->ssl), SSL_session_reused(conn->ssl) ? "resumed" : "full",
+                usec, conn->ktls ? "ktls" : "userspace");
+    }
+}
+
+// ALPN settled on HTTP/2, see init_ssl_ctx()
+static int selected_h2(conn_t *conn)
+{
+    const unsigned char *proto;
+    unsigned int len;
+    SSL_get0_alpn_selected(conn->ssl, &proto, &len);
+    return len == 2 && memcmp(proto, "h2", 2) == 0;
+}
+
+// copy a request field for the log, quotes and control characters would
+// break up the line
+static void copy_field(char *to, int size, const char *from, int len)
+{
+    if (len >= size)
+        len = size - 1;
+    for (int i = 0; i < len; i++)
+        to[i] = from[i] > ' ' && from[i] < 0x7f && from[i] != '"' ? from[i] : '?';
+    to[len] = '\0';
+}
+
+// hand the request to the access log, the record is dropped rather than
+// waited for when the log thread falls behind
+static void log_request(event_loop_t *loop, conn_t *conn, long usec)
+{
+    log_record_t *record = log_reserve(loop->log);
+    if (record == NULL)
+        return;
+
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->addr = conn->addr;
+    record->status = conn->status;
+    record->bytes = conn->sent;
+    record->usec = usec;
+
+    // a malformed request may not have got as far as its url
+    http_parser_t *parser = &conn->parser;
+    if (parser->state > PARSE_URL) {
+        copy_field(record->method, LOG_METHOD_SIZE, conn->request + parser->method.off, parser->method.len);
+        copy_field(record->url, LOG_URL_SIZE, conn->request + parser->url.off, parser->url.len);
+    } else {
+        strcpy(record->method, "-");
+        strcpy(record->url, "-");
+    }
+    log_commit(loop->log);
+}
+
+static int body_done(conn_t *conn)
+{
+    if (conn->body)
+        return conn->body_sent == conn->body_len;
+    return conn->buf_sent == conn->buf_len && conn->file_left <= 0;
+}
+
+// a request is answered, into the metrics and the access log with it
+void count_request(event_loop_t *loop, conn_t *conn)
+{
+    long usec = now_usec() - conn->request_usec;
+    count_response(&loop->metrics, conn->status, usec);
+    if (loop->log)
+        log_request(loop, conn, usec);
+}
+
+// the response is out, close or go on with the next request, which may
+// already be in the buffer when the client pipelines
+void finish_response(event_loop_t *loop, conn_t *conn)
+{
+    count_request(loop, conn);
+
+    if (!conn->keep_alive) {
+        conn->state = CONN_CLOSE;
+        return;
+    }
+
+    reset_response(conn);
+
+    int left = conn->request_len - conn->request_end;
+    memmove(conn->request, conn->request + conn->request_end, left);
+    conn->request_len = left;
+    conn->request[left] = '\0';
+    conn->request_end = 0;
+    init_parser(&conn->parser);
+
+    conn->state = CONN_READ_REQUEST;
+    if (left == 0)
+        start_idle(loop, conn);
+    else
+        set_deadline(loop, conn, config.header_timeout);
+}
+
+// a small in-memory body over TLS is copied behind the headers, so one
+// SSL_write() makes one record and usually one packet of the whole response
+// instead of a record for each. A HEAD has no body to copy.
+static void coalesce_response(conn_t *conn)
+{
+    int limit = config.buffer_size < TLS_RECORD_SIZE ? config.buffer_size : TLS_RECORD_SIZE;
+    if (conn->body == NULL || conn->body_len == 0 || conn->body == conn->buf || conn->nranges > 0 ||
+            conn->response_len + conn->body_len > limit)
+        return;
+    if (conn->buf == NULL && (conn->buf = malloc(config.buffer_size)) == NULL)
+        return;
+
+    memcpy(conn->buf, conn->response, conn->response_len);
+    memcpy(conn->buf + conn->response_len, conn->body, conn->body_len);
+    conn->body = conn->buf;
+    conn->body_len += conn->response_len;
+    conn->response_sent = conn->response_len;
+}
+
+// wait until the whole header block has arrived, the parser resumes where it
+// stopped so every byte is scanned once. Returns 1 once the response is
+// ready, 0 if more of the request has to be read first.
+int prepare_response(event_loop_t *loop, conn_t *conn)
+{
+    // a redirect needs little more than the url
+    int ret = conn->role == SERVE_REDIRECT ? parse_request_line(&conn->parser, conn->request, conn->request_len)
+                                           : parse_request(&conn->parser, conn->request, conn->request_len);
+    if (ret == PARSE_AGAIN && conn->request_len < REQUEST_BUF_SIZE)
+        return 0;
+    set_deadline(loop, conn, config.send_timeout);
+
+    conn->requests++;
+    conn->keep_alive = 0;
+    conn->request_usec = now_usec();
+
+    if (ret != PARSE_OK) {
+        // malformed, or the header block does not fit the buffer
+        conn->request_end = conn->request_len;
+        handle_bad_request(conn, ret == PARSE_ERROR ? BAD_REQUEST : HEADERS_TOO_LARGE);
+    } else {
+        conn->request_end = conn->parser.end;
+        if (conn->role == SERVE_REDIRECT)
+            handle_http_request(conn);
+        else if (conn->role == SERVE_ADMIN)
+            handle_admin_request(conn);
+        else if (wants_upload(conn))
+            handle_upload_request(conn, 0);
+        else
+            handle_file_request(conn);
+    }
+    conn->zero_copy = (conn->ssl == NULL || conn->ktls) && config.use_sendfile;
+    if (conn->ssl)
+        coalesce_response(conn);
+
+    return 1;
+}
+
+// the handshake is done, wait for the first request
+static void start_requests(event_loop_t *loop, conn_t *conn)
+{
+    set_deadline(loop, conn, config.header_timeout);
+    conn->state = CONN_READ_REQUEST;
+    if (selected_h2(conn)) {
+        conn->h2 = new_h2_session(conn);
+        conn->state = conn->h2 ? CONN_H2 : CONN_CLOSE;
+    }
+}
+
+// take everything on the handoff stack, oldest first
+conn_t *take_handoffs(event_loop_t *loop)
+{
+    conn_t *conn = __atomic_exchange_n(&loop->handoff.head, NULL, __ATOMIC_ACQUIRE);
+    conn_t *list = NULL;
+
+    while (conn) {
+        conn_t *next = conn->handoff_next;
+        conn->handoff_next = list;
+        list = conn;
+        conn = next;
+    }
+    return list;
+}
+
+// a connection from the handshake pool joins this loop, the caller registers
+// it with its engine and runs it, the client may have sent its request along
+// with the end of the handshake
+void adopt_conn(event_loop_t *loop, conn_t *conn)
+{
+    __atomic_sub_fetch(&loop->handoff.depth, 1, __ATOMIC_RELAXED);
+    stat_add(loop->nconns, 1);
+    start_requests(loop, conn);
+}
+
+// drive the state machine of a connection until it would block or is closed
+void process_conn(event_loop_t *loop, conn_t *conn)
+{
+    int n;
+
+    while (1) {
+        switch (conn->state) {
+            case CONN_HANDSHAKE:
+                n = SSL_accept(conn->ssl);
+                if (n == 1) {
+                    handshake_done(loop, conn);
+                    if (loop->handshake_only) {
+                        hand_off(loop, conn);
+                        return;
+                    }
+                    start_requests(loop, conn);
+                    break;
+                }
+                n = SSL_get_error(conn->ssl, n);
+                if (n == SSL_ERROR_WANT_READ || n == SSL_ERROR_WANT_WRITE)
+                    return;
+                conn->state = CONN_CLOSE;
+                break;
+
+            case CONN_READ_REQUEST:
+                if (prepare_response(loop, conn)) {
+                    conn->state = conn->upload ? CONN_READ_BODY : CONN_WRITE_HEADER;
+                    break;
+                }
+                n = conn_read(conn, conn->request + conn->request_len,
+                        REQUEST_BUF_SIZE - conn->request_len);
+                if (n < 0 && errno == EAGAIN)
+                    return;
+                if (n <= 0) {
+                    conn->state = CONN_CLOSE;
+                    break;
+                }
+                stop_idle(loop, conn);
+                conn->request_len += n;
+                conn->request[conn->request_len] = '\0';
+                break;
+
+            case CONN_READ_BODY:
+                n = read_upload(loop, conn);
+                if (n == 0)
+                    return;
+                conn->state = n > 0 ? CONN_WRITE_HEADER : CONN_CLOSE;
+                break;
+
+            case CONN_WRITE_HEADER:
+                if (conn->response_sent == conn->response_len) {
+                    conn->state = CONN_WRITE_BODY;
+                    break;
+                }
+                n = write_header(conn);
+                if (n < 0 && errno == EAGAIN)
+                    return;
+                if (n < 0) {
+                    conn->state = CONN_CLOSE;
+                    break;
+                }
+                conn_sent(loop, conn, n);
+                break;
+
+            case CONN_WRITE_BODY:
+                if (body_done(conn)) {
+                    if (next_range_part(conn))
+                        conn->state = CONN_WRITE_HEADER;
+                    else
+                        finish_response(loop, conn);
+                    break;
+                }
+                if (conn->body) {
+                    off_t count = conn->body_len - conn->body_sent;
+                    n = conn_write(conn, conn->body + conn->body_sent, count < BODY_CHUNK ? count : BODY_CHUNK);
+                    if (n < 0 && errno == EAGAIN)
+                        return;
+                    if (n < 0) {
+                        conn->state = CONN_CLOSE;
+                        break;
+                    }
+                    conn_sent(loop, conn, n);
+                    conn->body_sent += n;
+                    break;
+                }
+                if (conn->zero_copy) {
+                    size_t count = conn->file_left < BODY_CHUNK ? conn->file_left : BODY_CHUNK;
+                    ssize_t sent = conn_sendfile(conn, count);
+                    if (sent < 0 && errno == EAGAIN)
+                        return;
+                    if (sent <= 0) {
+                        conn->state = CONN_CLOSE;
+                        break;
+                    }
+                    conn_sent(loop, conn, sent);
+                    conn->file_left -= sent;
+                    break;
+                }
+                if (conn->buf_sent == conn->buf_len && fill_body_buffer(conn) < 0) {
+                    conn->state = CONN_CLOSE;
+                    break;
+                }
+                n = conn_write(conn, conn->buf + conn->buf_sent,
+                        conn->buf_len - conn->buf_sent);
+                if (n < 0 && errno == EAGAIN)
+                    return;
+                if (n < 0) {
+                    conn->state = CONN_CLOSE;
+                    break;
+                }
+                conn_sent(loop, conn, n);
+                conn->buf_sent += n;
+                break;
+
+            case CONN_H2:
+                if (h2_process(loop, conn) < 0) {
+                    conn->state = CONN_CLOSE;
+                    break;
+                }
+                // the streams have deadlines only as a whole: every write
+                // re-arms the send deadline, and with nothing in flight
+                // the connection idles like a kept-alive one
+                if (!h2_busy(conn->h2)) {
+                    start_idle(loop, conn);
+                } else if (conn->idle) {
+                    conn->idle = 0;
+                    set_deadline(loop, conn, config.send_timeout);
+                }
+                return;
+
+            case CONN_CLOSE:
+                close_conn(loop, conn);
+                return;
+        }
+    }
+}
+
+// set up a connection for an accepted socket, the caller registers it with
+// its engine. Returns NULL if there is no memory for it or admission control
+// has already answered it, the caller closes the socket then.
+conn_t *new_conn(event_loop_t *loop, listener_t *listener, int csock, struct sockaddr_in *addr)
+{
+    int client_slot;
+    if (admit_conn(loop, listener, csock, addr, &client_slot) < 0)
+        return NULL;
+
+    conn_t *conn = calloc(1, sizeof(conn_t));
+    if (conn == NULL) {
+        release_admission(client_slot);
+        return NULL;
+    }
+
+    // headers and body leave in separate writes, on a kept-alive
+    // connection Nagle would hold the second one back until the client's
+    // delayed ack
+    int enable = 1;
+    setsockopt(csock, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(int));
+
+    conn->type = EV_CONN;
+    conn->fd = csock;
+    conn->role = listener->role;
+    conn->client_slot = client_slot;
+    if (addr)
+        conn->addr = *addr;
+    conn->state = CONN_READ_REQUEST;
+    conn->file_fd = -1;
+    conn->fixed_buf = -1;
+    conn->fixed_file = -1;
+    init_parser(&conn->parser);
+
+    if (listener->role == SERVE_TLS) {
+        conn->ssl = SSL_new(ssl_ctx);
+        SSL_set_fd(conn->ssl, csock);
+        conn->state = CONN_HANDSHAKE;
+        conn->accept_usec = now_usec();
+        set_deadline(loop, conn, config.handshake_timeout);
+    } else {
+        set_deadline(loop, conn, config.header_timeout);
+    }
+
+    stat_add(loop->nconns, 1);
+    stat_add(loop->accepted, 1);
+
+    return conn;
+}
+
+// accept every pending connection on the listener
+static void accept_conns(event_loop_t *loop, listener_t *listener)
+{
+    while (1) {
+        struct sockaddr_in caddr;
+        socklen_t len = sizeof(caddr);
+        int csock = accept4(listener->fd, (struct sockaddr*)&caddr, &len, SOCK_NONBLOCK);
+        if (csock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN)
+                perror("Accept failed");
+            return;
+        }
+
+        conn_t *conn = new_conn(loop, listener, csock, &caddr);
+        if (conn == NULL) {
+            close(csock);
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, csock, &ev) < 0) {
+            perror("epoll_ctl failed");
+            close_conn(loop, conn);
+            continue;
+        }
+    }
+}
+
+static void adopt_conns(event_loop_t *loop)
+{
+    // drain the eventfd first, a push that comes after it wakes us again
+    unsigned long long count;
+    if (read(loop->handoff.fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("read eventfd failed");
+
+    conn_t *conn = take_handoffs(loop);
+    while (conn) {
+        conn_t *next = conn->handoff_next;
+        adopt_conn(loop, conn);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = conn;
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+            perror("epoll_ctl failed");
+            close_conn(loop, conn);
+        } else {
+            process_conn(loop, conn);
+        }
+        conn = next;
+    }
+}
+
+static void conn_expired(wheel_timer_t *timer, void *arg)
+{
+    event_loop_t *loop = arg;
+    conn_t *conn = list_entry(timer, conn_t, timer);
+
+    if (!conn->idle)
+        stat_add(loop->metrics.timeouts, 1);
+    close_conn(loop, conn);
+}
+
+// close the connections whose deadline has passed, only the slots of the
+// ticks since the last call are looked at
+void expire_conns(event_loop_t *loop)
+{
+    expire_timers(&loop->timers, now_sec(), conn_expired, loop);
+}
+
+void run_event_loop(event_loop_t *loop)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    if (loop->ring) {
+        run_uring_loop(loop);
+        return;
+    }
+
+    while (1) {
+        int timeout = loop->timers.armed ? 1000 : -1;
+        int n = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait failed");
+            exit(1);
+        }
+
+        start_turn(loop);
+        for (int i = 0; i < n; i++) {
+            int type = *(int *)events[i].data.ptr;
+            if (type == EV_LISTENER)
+                accept_conns(loop, events[i].data.ptr);
+            else if (type == EV_HANDOFF)
+                adopt_conns(loop);
+            else
+                process_conn(loop, events[i].data.ptr);
+        }
+        end_turn(loop);
+
+        expire_conns(loop);
+    }
+}
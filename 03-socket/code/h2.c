@@ -0,0 +1,836 @@
+#include "cache.h"
+#include "config.h"
+#include "h2.h"
+#include "http.h"
+#include "upload.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+static long now_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static unsigned get_u24(const unsigned char *p)
+{
+    return p[0] << 16 | p[1] << 8 | p[2];
+}
+
+static unsigned get_u32(const unsigned char *p)
+{
+    return (unsigned)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static void put_u32(unsigned char *p, unsigned v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void put_frame_header(unsigned char *p, int len, int type, int flags, unsigned stream)
+{
+    p[0] = len >> 16;
+    p[1] = len >> 8;
+    p[2] = len;
+    p[3] = type;
+    p[4] = flags;
+    put_u32(p + 5, stream & 0x7fffffff);
+}
+
+// queue a frame and return its payload to fill in, the caller makes sure it
+// fits
+static unsigned char *queue_frame(h2_session_t *h2, int len, int type, int flags, unsigned stream)
+{
+    unsigned char *p = h2->out + h2->out_len;
+    put_frame_header(p, len, type, flags, stream);
+    h2->out_len += H2_FRAME_HEADER + len;
+    return p + H2_FRAME_HEADER;
+}
+
+static int out_room(h2_session_t *h2)
+{
+    return H2_OUT_SIZE - h2->out_len;
+}
+
+static void send_rst_stream(h2_session_t *h2, unsigned stream, int error)
+{
+    put_u32(queue_frame(h2, 4, H2_RST_STREAM, 0, stream), error);
+}
+
+static void send_window_update(h2_session_t *h2, unsigned stream, unsigned increment)
+{
+    put_u32(queue_frame(h2, 4, H2_WINDOW_UPDATE, 0, stream), increment);
+}
+
+// tell the client why the connection goes away, the caller closes it once
+// the output is flushed
+static int connection_error(h2_session_t *h2, int error)
+{
+    if (out_room(h2) >= H2_FRAME_HEADER + 8) {
+        unsigned char *p = queue_frame(h2, 8, H2_GOAWAY, 0, 0);
+        put_u32(p, h2->last_stream);
+        put_u32(p + 4, error);
+    }
+    return -1;
+}
+
+h2_session_t *new_h2_session(conn_t *conn)
+{
+    h2_session_t *h2 = malloc(sizeof(h2_session_t));
+    if (h2 == NULL)
+        return NULL;
+
+    h2->conn = conn;
+    h2->preface = 0;
+    h2->in_len = 0;
+    h2->block_len = 0;
+    h2->block_stream = 0;
+    h2->block_end_stream = 0;
+    h2->out_len = 0;
+    h2->out_sent = 0;
+    init_hpack_table(&h2->decoder);
+    init_list_head(&h2->streams);
+    h2->nstreams = 0;
+    h2->last_stream = 0;
+    h2->window = H2_WINDOW;
+    h2->unacked = 0;
+    h2->initial_window = H2_WINDOW;
+    h2->goaway = 0;
+
+    // the server preface, the settings left out keep their defaults. The
+    // windows the client sends into are widened, request bodies are written
+    // out as they come and the default would stall an upload every 64k.
+    unsigned char *p = queue_frame(h2, 12, H2_SETTINGS, 0, 0);
+    p[0] = 0;
+    p[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    put_u32(p + 2, H2_MAX_STREAMS);
+    p[6] = 0;
+    p[7] = H2_SETTINGS_INITIAL_WINDOW_SIZE;
+    put_u32(p + 8, H2_RECV_WINDOW);
+    send_window_update(h2, 0, H2_RECV_WINDOW - H2_WINDOW);
+
+    return h2;
+}
+
+static h2_stream_t *new_stream(h2_session_t *h2, unsigned id)
+{
+    h2_stream_t *stream = calloc(1, sizeof(h2_stream_t));
+    if (stream == NULL)
+        return NULL;
+
+    stream->id = id;
+    stream->window = h2->initial_window;
+
+    // the handlers see a TLS connection of their own, the socket is never
+    // used and the ssl only tells them the request came over https
+    conn_t *req = &stream->req;
+    req->type = EV_CONN;
+    req->fd = -1;
+    req->role = SERVE_TLS;
+    req->addr = h2->conn->addr;
+    req->ssl = h2->conn->ssl;
+    req->file_fd = -1;
+    req->fixed_buf = -1;
+    req->fixed_file = -1;
+    init_parser(&req->parser);
+
+    list_add_tail(&stream->list, &h2->streams);
+    h2->nstreams++;
+    return stream;
+}
+
+static void free_stream(h2_session_t *h2, h2_stream_t *stream)
+{
+    conn_t *req = &stream->req;
+    if (req->file_fd >= 0)
+        close(req->file_fd);
+    if (req->cache_entry)
+        cache_release(req->cache_entry);
+    if (req->upload)
+        free_upload(req->upload);
+    free(req->buf);
+
+    list_delete_entry(&stream->list);
+    h2->nstreams--;
+    free(stream);
+}
+
+void free_h2_session(h2_session_t *h2)
+{
+    h2_stream_t *stream, *q;
+    list_for_each_entry_safe(stream, q, &h2->streams, list)
+        free_stream(h2, stream);
+    free(h2);
+}
+
+static h2_stream_t *find_stream(h2_session_t *h2, unsigned id)
+{
+    h2_stream_t *stream;
+    list_for_each_entry(stream, &h2->streams, list) {
+        if (stream->id == id)
+            return stream;
+    }
+    return NULL;
+}
+
+// a request rebuilt from a header block: the pseudo-headers become the
+// request line and :authority the Host header
+typedef struct request_builder {
+    char method[16];
+    int method_len;
+    char path[REQUEST_BUF_SIZE];
+    int path_len;
+    int scheme;
+    char headers[REQUEST_BUF_SIZE];
+    int headers_len;
+    int regular;                        // a regular header came, pseudo ones may not follow
+    int malformed;
+    int too_large;
+} request_builder_t;
+
+static void append_header(request_builder_t *b, const char *name, int name_len, const char *value, int value_len)
+{
+    if (b->headers_len + name_len + value_len + 4 > REQUEST_BUF_SIZE) {
+        b->too_large = 1;
+        return;
+    }
+    char *p = b->headers + b->headers_len;
+    memcpy(p, name, name_len);
+    memcpy(p + name_len, ": ", 2);
+    memcpy(p + name_len + 2, value, value_len);
+    memcpy(p + name_len + 2 + value_len, "\r\n", 2);
+    b->headers_len += name_len + value_len + 4;
+}
+
+static int name_is(const char *name, int len, const char *str)
+{
+    return len == (int)strlen(str) && memcmp(name, str, len) == 0;
+}
+
+// RFC 9113 8.2: names are lowercase, nothing may smuggle in a line break,
+// and the headers of HTTP/1.1 connection management have no place here
+static void add_header(void *arg, const char *name, int name_len, const char *value, int value_len)
+{
+    request_builder_t *b = arg;
+
+    for (int i = 0; i < name_len; i++) {
+        char c = name[i];
+        if ((c >= 'A' && c <= 'Z') || c == '\r' || c == '\n' || c == '\0' || c == ' ' || (c == ':' && i > 0))
+            b->malformed = 1;
+    }
+    if (name_len == 0 || memchr(value, '\r', value_len) || memchr(value, '\n', value_len) || memchr(value, '\0', value_len))
+        b->malformed = 1;
+    if (b->malformed)
+        return;
+
+    if (name[0] == ':') {
+        if (b->regular) {
+            b->malformed = 1;
+        } else if (name_is(name, name_len, ":method")) {
+            if (b->method_len || value_len == 0 || value_len >= (int)sizeof(b->method)) {
+                b->malformed = 1;
+                return;
+            }
+            memcpy(b->method, value, value_len);
+            b->method_len = value_len;
+        } else if (name_is(name, name_len, ":path")) {
+            if (b->path_len || value_len == 0)
+                b->malformed = 1;
+            else if (value_len > REQUEST_BUF_SIZE)
+                b->too_large = 1;
+            else
+                memcpy(b->path, value, value_len);
+            b->path_len = value_len;
+        } else if (name_is(name, name_len, ":scheme")) {
+            b->scheme = 1;
+        } else if (name_is(name, name_len, ":authority")) {
+            append_header(b, "host", 4, value, value_len);
+        } else {
+            b->malformed = 1;
+        }
+        return;
+    }
+
+    b->regular = 1;
+    if (name_is(name, name_len, "connection") || name_is(name, name_len, "keep-alive") ||
+            name_is(name, name_len, "proxy-connection") || name_is(name, name_len, "transfer-encoding") ||
+            name_is(name, name_len, "upgrade") ||
+            (name_is(name, name_len, "te") && !(value_len == 8 && memcmp(value, "trailers", 8) == 0))) {
+        b->malformed = 1;
+        return;
+    }
+    append_header(b, name, name_len, value, value_len);
+}
+
+static void discard_header(void *arg, const char *name, int name_len, const char *value, int value_len)
+{
+}
+
+// a new stream: decode its request and let the HTTP/1.1 handlers answer it,
+// the response goes out as the scheduler gets to it, for an upload once the
+// body is in
+static int start_stream(h2_session_t *h2, unsigned id, const unsigned char *block, int len, int end_stream)
+{
+    request_builder_t b;
+    b.method_len = 0;
+    b.path_len = 0;
+    b.scheme = 0;
+    b.headers_len = 0;
+    b.regular = 0;
+    b.malformed = 0;
+    b.too_large = 0;
+
+    // every block is decoded, refused or not, or the table gets out of step
+    if (hpack_decode(&h2->decoder, block, len, add_header, &b) < 0)
+        return connection_error(h2, H2_COMPRESSION_ERROR);
+
+    h2->last_stream = id;
+    if (h2->nstreams >= H2_MAX_STREAMS) {
+        send_rst_stream(h2, id, H2_REFUSED_STREAM);
+        return 0;
+    }
+    if (b.malformed || b.method_len == 0 || b.path_len == 0 || !b.scheme) {
+        send_rst_stream(h2, id, H2_PROTOCOL_ERROR);
+        return 0;
+    }
+
+    h2_stream_t *stream = new_stream(h2, id);
+    if (stream == NULL) {
+        send_rst_stream(h2, id, H2_INTERNAL_ERROR);
+        return 0;
+    }
+    stream->head_only = b.method_len == 4 && memcmp(b.method, "HEAD", 4) == 0;
+    stream->remote_open = !end_stream;
+
+    conn_t *req = &stream->req;
+    req->requests = 1;
+    req->request_usec = now_usec();
+
+    int n = b.too_large ? REQUEST_BUF_SIZE : snprintf(req->request, sizeof(req->request), "%.*s %.*s HTTP/1.1\r\n%.*s\r\n",
+            b.method_len, b.method, b.path_len, b.path, b.headers_len, b.headers);
+    if (n >= REQUEST_BUF_SIZE) {
+        req->request[0] = '\0';
+        handle_bad_request(req, HEADERS_TOO_LARGE);
+        return 0;
+    }
+    req->request_len = n;
+    req->request_end = n;
+
+    int ret = parse_request(&req->parser, req->request, n);
+    if (ret == PARSE_OK && wants_upload(req)) {
+        handle_upload_request(req, 1);
+        if (req->upload && end_stream)
+            finish_upload(req);
+    } else if (ret == PARSE_OK) {
+        handle_file_request(req);
+    } else
+        handle_bad_request(req, ret == PARSE_TOO_LARGE ? HEADERS_TOO_LARGE : BAD_REQUEST);
+    return 0;
+}
+
+// the client sent the last of the request, an upload is complete
+static void end_request(h2_stream_t *stream)
+{
+    stream->remote_open = 0;
+    if (stream->req.upload)
+        finish_upload(&stream->req);
+}
+
+static int header_block(h2_session_t *h2, unsigned id, const unsigned char *block, int len, int end_stream)
+{
+    if (!(id & 1))
+        return connection_error(h2, H2_PROTOCOL_ERROR);
+    if (id > h2->last_stream)
+        return start_stream(h2, id, block, len, end_stream);
+
+    // trailers, or headers of a stream already answered
+    if (hpack_decode(&h2->decoder, block, len, discard_header, NULL) < 0)
+        return connection_error(h2, H2_COMPRESSION_ERROR);
+    h2_stream_t *stream = find_stream(h2, id);
+    if (end_stream && stream)
+        end_request(stream);
+    return 0;
+}
+
+static int apply_settings(h2_session_t *h2, const unsigned char *p, int len)
+{
+    for (int i = 0; i + 6 <= len; i += 6) {
+        unsigned id = p[i] << 8 | p[i + 1];
+        unsigned value = get_u32(p + i + 2);
+
+        switch (id) {
+            case H2_SETTINGS_ENABLE_PUSH:
+                if (value > 1)
+                    return connection_error(h2, H2_PROTOCOL_ERROR);
+                break;
+
+            case H2_SETTINGS_INITIAL_WINDOW_SIZE: {
+                // open streams move by the difference, RFC 9113 6.9.2
+                if (value > H2_MAX_WINDOW)
+                    return connection_error(h2, H2_FLOW_CONTROL_ERROR);
+                long delta = (long)value - h2->initial_window;
+                h2_stream_t *stream;
+                list_for_each_entry(stream, &h2->streams, list) {
+                    stream->window += delta;
+                    if (stream->window > H2_MAX_WINDOW)
+                        return connection_error(h2, H2_FLOW_CONTROL_ERROR);
+                }
+                h2->initial_window = value;
+                break;
+            }
+
+            case H2_SETTINGS_MAX_FRAME_SIZE:
+                if (value < H2_MAX_FRAME || value > 0xffffff)
+                    return connection_error(h2, H2_PROTOCOL_ERROR);
+                // larger frames would not save much, stay at the default
+                break;
+        }
+    }
+    queue_frame(h2, 0, H2_SETTINGS, H2_FLAG_ACK, 0);
+    return 0;
+}
+
+static int handle_frame(event_loop_t *loop, h2_session_t *h2, int type, int flags, unsigned id, const unsigned char *p, int len)
+{
+    // nothing may come between the frames of a header block
+    if (h2->block_stream && (type != H2_CONTINUATION || id != h2->block_stream))
+        return connection_error(h2, H2_PROTOCOL_ERROR);
+
+    switch (type) {
+        case H2_DATA: {
+            // the body of an upload is stored as it comes, any other is
+            // only taken out of the windows again
+            if (id == 0 || id > h2->last_stream)
+                return connection_error(h2, H2_PROTOCOL_ERROR);
+            if ((flags & H2_FLAG_PADDED) && (len < 1 || p[0] >= len))
+                return connection_error(h2, H2_PROTOCOL_ERROR);
+            // the windows are given back in halves, an update per frame
+            // would cost a write per frame
+            h2_stream_t *stream = find_stream(h2, id);
+            h2->unacked += len;
+            if (h2->unacked >= H2_RECV_WINDOW / 2) {
+                send_window_update(h2, 0, h2->unacked);
+                h2->unacked = 0;
+            }
+            if (!(flags & H2_FLAG_END_STREAM) && stream && (stream->unacked += len) >= H2_RECV_WINDOW / 2) {
+                send_window_update(h2, id, stream->unacked);
+                stream->unacked = 0;
+            }
+            if (stream == NULL || !stream->remote_open)
+                return 0;
+
+            conn_t *req = &stream->req;
+            if (req->upload) {
+                int pad = flags & H2_FLAG_PADDED ? 1 + p[0] : 0;
+                conn_received(loop, h2->conn, len - pad);
+                if (upload_data(req->upload, (const char *)p + (pad ? 1 : 0), len - pad) < 0)
+                    finish_upload(req);
+            }
+            if (flags & H2_FLAG_END_STREAM)
+                end_request(stream);
+            return 0;
+        }
+
+        case H2_HEADERS: {
+            if (id == 0)
+                return connection_error(h2, H2_PROTOCOL_ERROR);
+            if (flags & H2_FLAG_PADDED) {
+                if (len < 1 || p[0] >= len)
+                    return connection_error(h2, H2_PROTOCOL_ERROR);
+                len -= 1 + p[0];
+                p++;
+            }
+            // priorities are not followed, every stream gets its turn
+            if (flags & H2_FLAG_PRIORITY) {
+                if (len < 5)
+                    return connection_error(h2, H2_FRAME_SIZE_ERROR);
+                p += 5;
+                len -= 5;
+            }
+            if (flags & H2_FLAG_END_HEADERS)
+                return header_block(h2, id, p, len, flags & H2_FLAG_END_STREAM);
+
+            memcpy(h2->block, p, len);
+            h2->block_len = len;
+            h2->block_stream = id;
+            h2->block_end_stream = flags & H2_FLAG_END_STREAM;
+            return 0;
+        }
+
+        case H2_CONTINUATION:
+            if (h2->block_stream == 0)
+                return connection_error(h2, H2_PROTOCOL_ERROR);
+            if (h2->block_len + len > H2_MAX_HEADER_BLOCK)
+                return connection_error(h2, H2_ENHANCE_YOUR_CALM);
+            memcpy(h2->block + h2->block_len, p, len);
+            h2->block_len += len;
+            if (flags & H2_FLAG_END_HEADERS) {
+                h2->block_stream = 0;
+                return header_block(h2, id, h2->block, h2->block_len, h2->block_end_stream);
+            }
+            return 0;
+
+        case H2_PRIORITY:
+            if (id == 0)
+                return connection_error(h2, H2_PROTOCOL_ERROR);
+            return 0;
+
+        case H2_RST_STREAM: {
+            if (len != 4)
+                return connection_error(h2, H2_FRAME_SIZE_ERROR);
+            if (id == 0 || id > h2->last_stream)
+                return connection_error(h2, H2_PROTOCOL_ERROR);
+            h2_stream_t *stream = find_stream(h2, id);
+            if (stream)
+                free_stream(h2, stream);
+            return 0;
+        }
+
+        case H2_SETTINGS:
+            if (id != 0)
+                return connection_error(h2, H2_PROTOCOL_ERROR);
+            if (flags & H2_FLAG_ACK)
+                return len == 0 ? 0 : connection_error(h2, H2_FRAME_SIZE_ERROR);
+            if (len % 6 != 0)
+                return connection_error(h2, H2_FRAME_SIZE_ERROR);
+            return apply_settings(h2, p, len);
+
+        case H2_PUSH_PROMISE:
+            // clients never push
+            return connection_error(h2, H2_PROTOCOL_ERROR);
+
+        case H2_PING:
+            if (len != 8)
+                return connection_error(h2, H2_FRAME_SIZE_ERROR);
+            if (id != 0)
+                return connection_error(h2, H2_PROTOCOL_ERROR);
+            if (!(flags & H2_FLAG_ACK))
+                memcpy(queue_frame(h2, 8, H2_PING, H2_FLAG_ACK, 0), p, 8);
+            return 0;
+
+        case H2_GOAWAY:
+            if (id != 0)
+                return connection_error(h2, H2_PROTOCOL_ERROR);
+            h2->goaway = 1;
+            return 0;
+
+        case H2_WINDOW_UPDATE: {
+            if (len != 4)
+                return connection_error(h2, H2_FRAME_SIZE_ERROR);
+            unsigned increment = get_u32(p) & 0x7fffffff;
+            if (id == 0) {
+                if (increment == 0)
+                    return connection_error(h2, H2_PROTOCOL_ERROR);
+                h2->window += increment;
+                if (h2->window > H2_MAX_WINDOW)
+                    return connection_error(h2, H2_FLOW_CONTROL_ERROR);
+                return 0;
+            }
+            if (id > h2->last_stream)
+                return connection_error(h2, H2_PROTOCOL_ERROR);
+            h2_stream_t *stream = find_stream(h2, id);
+            if (stream == NULL)
+                return 0;
+            stream->window += increment;
+            if (increment == 0 || stream->window > H2_MAX_WINDOW) {
+                send_rst_stream(h2, id, increment == 0 ? H2_PROTOCOL_ERROR : H2_FLOW_CONTROL_ERROR);
+                free_stream(h2, stream);
+            }
+            return 0;
+        }
+
+        default:
+            // unknown frame types are ignored, RFC 9113 4.1
+            return 0;
+    }
+}
+
+// handle the frames that are complete in the input, as long as the output
+// has room for what they may queue. Returns 1 if anything was consumed, -1
+// on a connection error.
+static int process_frames(event_loop_t *loop, h2_session_t *h2)
+{
+    int pos = 0;
+
+    if (h2->preface < H2_PREFACE_LEN) {
+        int n = h2->in_len < H2_PREFACE_LEN - h2->preface ? h2->in_len : H2_PREFACE_LEN - h2->preface;
+        if (memcmp(h2->in, H2_PREFACE + h2->preface, n) != 0)
+            return -1;
+        h2->preface += n;
+        pos = n;
+    }
+
+    while (h2->preface == H2_PREFACE_LEN && h2->in_len - pos >= H2_FRAME_HEADER &&
+            out_room(h2) >= H2_OUT_RESERVE) {
+        const unsigned char *p = h2->in + pos;
+        int len = get_u24(p);
+        if (len > H2_MAX_FRAME)
+            return connection_error(h2, H2_FRAME_SIZE_ERROR);
+        if (h2->in_len - pos < H2_FRAME_HEADER + len)
+            break;
+        if (handle_frame(loop, h2, p[3], p[4], get_u32(p + 5) & 0x7fffffff, p + H2_FRAME_HEADER, len) < 0)
+            return -1;
+        pos += H2_FRAME_HEADER + len;
+    }
+
+    memmove(h2->in, h2->in + pos, h2->in_len - pos);
+    h2->in_len -= pos;
+    return pos > 0;
+}
+
+// the response headers as a HEADERS block: the status line goes, and so do
+// the headers that only mean something to an HTTP/1.1 connection. Bytes
+// behind the header block, the first part header of a multipart body, are
+// left to be sent as data.
+static int encode_response(h2_stream_t *stream, unsigned char *out, int size)
+{
+    conn_t *req = &stream->req;
+    char *response = req->response;
+    char *head_end = memmem(response, req->response_len, "\r\n\r\n", 4);
+    if (head_end == NULL)
+        return -1;
+
+    int n = hpack_encode_status(out, size, req->status);
+    if (n < 0)
+        return -1;
+
+    char *line = memchr(response, '\n', head_end - response + 2) + 1;
+    while (line < head_end + 2) {
+        char *eol = memchr(line, '\r', head_end + 2 - line);
+        char *colon = memchr(line, ':', eol - line);
+        if (colon) {
+            int name_len = colon - line;
+            char *value = colon + 1;
+            while (value < eol && *value == ' ')
+                value++;
+            if (!(name_len == 10 && strncasecmp(line, "Connection", 10) == 0)) {
+                int m = hpack_encode_header(out + n, size - n, line, name_len, value, eol - value);
+                if (m < 0)
+                    return -1;
+                n += m;
+            }
+        }
+        line = eol + 2;
+    }
+
+    req->response_sent = head_end + 4 - response;
+    return n;
+}
+
+static int has_body(h2_stream_t *stream)
+{
+    conn_t *req = &stream->req;
+    if (stream->head_only)
+        return 0;
+    return req->response_sent < req->response_len || req->nranges > 0 ||
+            (req->body ? req->body_sent < req->body_len : req->file_left > 0);
+}
+
+// copy up to size bytes of the body: what is left in the response buffer,
+// the in-memory body or the file, part after part for multipart bodies.
+// Returns the bytes copied, -1 if the file cannot be read.
+static int fill_data(h2_stream_t *stream, unsigned char *out, int size, int *done)
+{
+    conn_t *req = &stream->req;
+    int n = 0;
+
+    while (1) {
+        if (req->response_sent < req->response_len) {
+            int count = req->response_len - req->response_sent;
+            if (count > size - n)
+                count = size - n;
+            if (count == 0)
+                break;
+            memcpy(out + n, req->response + req->response_sent, count);
+            req->response_sent += count;
+            n += count;
+        } else if (req->body && req->body_sent < req->body_len) {
+            off_t count = req->body_len - req->body_sent;
+            if (count > size - n)
+                count = size - n;
+            if (count == 0)
+                break;
+            memcpy(out + n, req->body + req->body_sent, count);
+            req->body_sent += count;
+            n += count;
+        } else if (req->body == NULL && req->file_left > 0) {
+            off_t count = req->file_left < size - n ? req->file_left : size - n;
+            if (count == 0)
+                break;
+            ssize_t got = pread(req->file_fd, out + n, count, req->file_offset);
+            if (got <= 0)
+                return -1;
+            req->file_offset += got;
+            req->file_left -= got;
+            n += got;
+        } else if (!next_range_part(req)) {
+            *done = 1;
+            break;
+        }
+    }
+    return n;
+}
+
+static void finish_stream(event_loop_t *loop, h2_session_t *h2, h2_stream_t *stream)
+{
+    // answered before the client sent all of the request, which it may
+    // stop sending now, RFC 9113 8.1
+    if (stream->remote_open)
+        send_rst_stream(h2, stream->id, H2_NO_ERROR);
+    count_request(loop, &stream->req);
+    free_stream(h2, stream);
+}
+
+// queue the next frame of a stream, returns 1 if one was queued
+static int send_stream(event_loop_t *loop, h2_session_t *h2, h2_stream_t *stream)
+{
+    conn_t *req = &stream->req;
+    unsigned char *frame = h2->out + h2->out_len;
+    int room = out_room(h2) - H2_OUT_RESERVE - H2_FRAME_HEADER;
+
+    // an upload is answered once its body is in
+    if (req->upload)
+        return 0;
+
+    if (!stream->headers_sent) {
+        // any response header block fits this much
+        if (room < 2 * RESPONSE_BUF_SIZE)
+            return 0;
+        int n = encode_response(stream, frame + H2_FRAME_HEADER, room);
+        if (n < 0) {
+            send_rst_stream(h2, stream->id, H2_INTERNAL_ERROR);
+            free_stream(h2, stream);
+            return 1;
+        }
+        int end = !has_body(stream);
+        put_frame_header(frame, n, H2_HEADERS, H2_FLAG_END_HEADERS | (end ? H2_FLAG_END_STREAM : 0), stream->id);
+        h2->out_len += H2_FRAME_HEADER + n;
+        req->sent += n;
+        stream->headers_sent = 1;
+        if (end)
+            finish_stream(loop, h2, stream);
+        return 1;
+    }
+
+    long size = room;
+    if (size > H2_MAX_FRAME)
+        size = H2_MAX_FRAME;
+    if (size > h2->window)
+        size = h2->window;
+    if (size > stream->window)
+        size = stream->window;
+    if (size < 0)
+        size = 0;
+
+    int done = 0;
+    int n = fill_data(stream, frame + H2_FRAME_HEADER, size, &done);
+    if (n < 0) {
+        send_rst_stream(h2, stream->id, H2_INTERNAL_ERROR);
+        free_stream(h2, stream);
+        return 1;
+    }
+    if (n == 0 && !done)
+        return 0;
+
+    put_frame_header(frame, n, H2_DATA, done ? H2_FLAG_END_STREAM : 0, stream->id);
+    h2->out_len += H2_FRAME_HEADER + n;
+    h2->window -= n;
+    stream->window -= n;
+    req->sent += n;
+    if (done)
+        finish_stream(loop, h2, stream);
+    return 1;
+}
+
+// one frame per stream and round, so a large file does not hold up the
+// small ones requested next to it. Returns 1 if anything was queued.
+static int schedule(event_loop_t *loop, h2_session_t *h2)
+{
+    int queued = 0, progress;
+
+    do {
+        h2_stream_t *stream, *q;
+        progress = 0;
+        list_for_each_entry_safe(stream, q, &h2->streams, list)
+            progress |= send_stream(loop, h2, stream);
+        queued |= progress;
+    } while (progress);
+
+    return queued;
+}
+
+// write out the queued frames, returns 1 if anything went out, 0 if nothing
+// did or the socket is full, -1 on errors
+static int flush(event_loop_t *loop, h2_session_t *h2)
+{
+    int wrote = 0;
+
+    while (h2->out_sent < h2->out_len) {
+        int n = conn_write(h2->conn, (char *)h2->out + h2->out_sent, h2->out_len - h2->out_sent);
+        if (n < 0 && errno == EAGAIN)
+            break;
+        if (n <= 0)
+            return -1;
+        conn_sent(loop, h2->conn, n);
+        h2->out_sent += n;
+        wrote = 1;
+    }
+
+    // a pending write may be retried from a moved buffer, see init_ssl_ctx()
+    memmove(h2->out, h2->out + h2->out_sent, h2->out_len - h2->out_sent);
+    h2->out_len -= h2->out_sent;
+    h2->out_sent = 0;
+    return wrote;
+}
+
+int h2_process(event_loop_t *loop, conn_t *conn)
+{
+    h2_session_t *h2 = conn->h2;
+
+    while (1) {
+        int progress = process_frames(loop, h2);
+        if (progress < 0) {
+            flush(loop, h2);
+            return -1;
+        }
+        progress |= schedule(loop, h2);
+
+        int n = flush(loop, h2);
+        if (n < 0)
+            return -1;
+        progress |= n;
+
+        // the client said goodbye and has everything it asked for
+        if (h2->goaway && h2->nstreams == 0 && h2->out_len == 0)
+            return -1;
+
+        if (h2->in_len < (int)sizeof(h2->in)) {
+            n = conn_read(conn, (char *)h2->in + h2->in_len, sizeof(h2->in) - h2->in_len);
+            if (n == 0 || (n < 0 && errno != EAGAIN))
+                return -1;
+            if (n > 0) {
+                h2->in_len += n;
+                progress = 1;
+            }
+        }
+
+        // everything waits for the socket or the client's window
+        if (!progress)
+            return 0;
+    }
+}
+
+int h2_busy(h2_session_t *h2)
+{
+    return h2->preface < H2_PREFACE_LEN || h2->nstreams > 0 || h2->out_len > 0 ||
+            h2->in_len > 0 || h2->block_stream != 0;
+}
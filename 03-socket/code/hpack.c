@@ -0,0 +1,406 @@
+#include "hpack.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+// RFC 7541 appendix A
+static const struct { const char *name, *value; } static_table[HPACK_STATIC_ENTRIES] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+// the Huffman code of RFC 7541 appendix B is canonical: the codes of one
+// length are consecutive and follow the symbols' order, so a code of length
+// n decodes to huffman_symbols[huffman_offset[n] + code - huffman_first[n]]
+// when it is below huffman_first[n] + huffman_count[n]
+static const unsigned short huffman_symbols[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+    45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+    95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+    58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+    106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+    88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+    0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+    167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+    173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+    183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+    255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+    246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+    6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+    249, 10, 13, 22, 256,
+};
+static const unsigned int huffman_first[31] = {
+    0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+    0x14, 0x5c, 0xf8, 0x0, 0x3f8, 0x7fa,
+    0xffa, 0x1ff8, 0x3ffc, 0x7ffc, 0x0, 0x0,
+    0x0, 0x7fff0, 0xfffe6, 0x1fffdc, 0x3fffd2, 0x7fffd8,
+    0xffffea, 0x1ffffec, 0x3ffffe0, 0x7ffffde, 0xfffffe2, 0x0,
+    0x3ffffffc,
+};
+static const unsigned char huffman_count[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3,
+    2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29,
+    12, 4, 15, 19, 29, 0, 4,
+};
+static const unsigned short huffman_offset[31] = {
+    0, 0, 0, 0, 0, 0, 10, 36, 68, 0, 74, 79,
+    82, 84, 90, 92, 0, 0, 0, 95, 98, 106, 119, 145,
+    174, 186, 190, 205, 224, 0, 253,
+};
+
+#define HUFFMAN_EOS 256
+
+void init_hpack_table(hpack_table_t *table)
+{
+    table->used = 0;
+    table->count = 0;
+    table->size = 0;
+    table->max_size = HPACK_TABLE_SIZE;
+}
+
+// drop the oldest entries until the table size is at most limit
+static void evict(hpack_table_t *table, int limit)
+{
+    int n = 0, bytes = 0;
+    while (n < table->count && table->size > limit) {
+        int len = table->entries[n].name_len + table->entries[n].value_len;
+        bytes += len;
+        table->size -= len + HPACK_ENTRY_OVERHEAD;
+        n++;
+    }
+    if (n == 0)
+        return;
+
+    memmove(table->data, table->data + bytes, table->used - bytes);
+    table->used -= bytes;
+    memmove(table->entries, table->entries + n, (table->count - n) * sizeof(table->entries[0]));
+    table->count -= n;
+    for (int i = 0; i < table->count; i++)
+        table->entries[i].off -= bytes;
+}
+
+// name and value must not point into the table, eviction moves it
+static void add_entry(hpack_table_t *table, const char *name, int name_len, const char *value, int value_len)
+{
+    int cost = name_len + value_len + HPACK_ENTRY_OVERHEAD;
+    if (cost > table->max_size) {
+        // an entry larger than the table just empties it
+        evict(table, 0);
+        return;
+    }
+    evict(table, table->max_size - cost);
+
+    int i = table->count++;
+    table->entries[i].off = table->used;
+    table->entries[i].name_len = name_len;
+    table->entries[i].value_len = value_len;
+    memcpy(table->data + table->used, name, name_len);
+    memcpy(table->data + table->used + name_len, value, value_len);
+    table->used += name_len + value_len;
+    table->size += cost;
+}
+
+// the static table comes first, then the dynamic one newest first
+static int lookup(hpack_table_t *table, unsigned index, const char **name, int *name_len,
+        const char **value, int *value_len)
+{
+    if (index == 0)
+        return -1;
+    if (index <= HPACK_STATIC_ENTRIES) {
+        *name = static_table[index - 1].name;
+        *name_len = strlen(*name);
+        *value = static_table[index - 1].value;
+        *value_len = strlen(*value);
+        return 0;
+    }
+
+    index -= HPACK_STATIC_ENTRIES + 1;
+    if (index >= (unsigned)table->count)
+        return -1;
+    int i = table->count - 1 - index;
+    *name = table->data + table->entries[i].off;
+    *name_len = table->entries[i].name_len;
+    *value = *name + *name_len;
+    *value_len = table->entries[i].value_len;
+    return 0;
+}
+
+// an integer with an n-bit prefix, -1 if it runs past the end or is larger
+// than any sane header needs
+static int decode_int(const unsigned char **p, const unsigned char *end, int prefix, unsigned *value)
+{
+    unsigned max = (1u << prefix) - 1;
+    unsigned v = *(*p)++ & max;
+
+    if (v == max) {
+        for (int shift = 0; ; shift += 7) {
+            if (*p == end || shift > 21)
+                return -1;
+            unsigned char b = *(*p)++;
+            v += (unsigned)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+    }
+    *value = v;
+    return 0;
+}
+
+static int huffman_decode(const unsigned char *in, int len, char *out, int size)
+{
+    unsigned long long bits = 0;
+    int nbits = 0, pos = 0, n = 0;
+
+    while (1) {
+        while (nbits <= 56 && pos < len) {
+            bits = bits << 8 | in[pos++];
+            nbits += 8;
+        }
+        if (nbits == 0)
+            break;
+
+        int sym = -1, code_len;
+        for (code_len = 5; code_len <= 30 && code_len <= nbits; code_len++) {
+            unsigned code = (bits >> (nbits - code_len)) & ((1u << code_len) - 1);
+            if (code - huffman_first[code_len] < huffman_count[code_len]) {
+                sym = huffman_symbols[huffman_offset[code_len] + code - huffman_first[code_len]];
+                break;
+            }
+        }
+        if (sym < 0) {
+            // what is left has to be padding: the most significant bits of
+            // EOS, all ones and shorter than a byte
+            if (nbits > 7 || (bits & ((1u << nbits) - 1)) != (1u << nbits) - 1)
+                return -1;
+            break;
+        }
+        if (sym == HUFFMAN_EOS || n == size)
+            return -1;
+        out[n++] = sym;
+        nbits -= code_len;
+        bits &= (1ULL << nbits) - 1;
+    }
+    return n;
+}
+
+// a string literal, copied or Huffman decoded into buf
+static int decode_string(const unsigned char **p, const unsigned char *end, char *buf, int *len)
+{
+    if (*p == end)
+        return -1;
+    int huffman = **p & 0x80;
+    unsigned n;
+    if (decode_int(p, end, 7, &n) < 0 || n > (unsigned)(end - *p))
+        return -1;
+
+    if (huffman) {
+        *len = huffman_decode(*p, n, buf, HPACK_STRING_MAX);
+        if (*len < 0)
+            return -1;
+    } else {
+        if (n > HPACK_STRING_MAX)
+            return -1;
+        memcpy(buf, *p, n);
+        *len = n;
+    }
+    *p += n;
+    return 0;
+}
+
+int hpack_decode(hpack_table_t *table, const unsigned char *in, int len, hpack_emit_t emit, void *arg)
+{
+    const unsigned char *p = in, *end = in + len;
+    char name_buf[HPACK_STRING_MAX], value_buf[HPACK_STRING_MAX];
+    int headers = 0;
+
+    while (p < end) {
+        const char *name, *value;
+        int name_len, value_len;
+        unsigned index;
+        unsigned char b = *p;
+
+        if (b & 0x80) {
+            // indexed header field
+            if (decode_int(&p, end, 7, &index) < 0 || lookup(table, index, &name, &name_len, &value, &value_len) < 0)
+                return -1;
+        } else if ((b & 0xe0) == 0x20) {
+            // dynamic table size update, only in front of the first header
+            if (headers > 0 || decode_int(&p, end, 5, &index) < 0 || index > HPACK_TABLE_SIZE)
+                return -1;
+            table->max_size = index;
+            evict(table, index);
+            continue;
+        } else {
+            // literal with incremental indexing (01), without indexing
+            // (0000) or never indexed (0001), the name indexed or literal
+            int indexing = (b & 0xc0) == 0x40;
+            if (decode_int(&p, end, indexing ? 6 : 4, &index) < 0)
+                return -1;
+            if (index == 0) {
+                if (decode_string(&p, end, name_buf, &name_len) < 0)
+                    return -1;
+            } else {
+                const char *indexed;
+                if (lookup(table, index, &indexed, &name_len, &value, &value_len) < 0)
+                    return -1;
+                memcpy(name_buf, indexed, name_len);
+            }
+            if (decode_string(&p, end, value_buf, &value_len) < 0)
+                return -1;
+            name = name_buf;
+            value = value_buf;
+            if (indexing)
+                add_entry(table, name, name_len, value, value_len);
+        }
+
+        headers++;
+        emit(arg, name, name_len, value, value_len);
+    }
+    return 0;
+}
+
+static int encode_int(unsigned char *out, int size, unsigned value, int prefix, unsigned char flags)
+{
+    unsigned max = (1u << prefix) - 1;
+    int n = 0;
+
+    if (size < 1)
+        return -1;
+    if (value < max) {
+        out[0] = flags | value;
+        return 1;
+    }
+    out[n++] = flags | max;
+    value -= max;
+    while (value >= 0x80) {
+        if (n == size)
+            return -1;
+        out[n++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    if (n == size)
+        return -1;
+    out[n++] = value;
+    return n;
+}
+
+static int encode_string(unsigned char *out, int size, const char *s, int len, int lower)
+{
+    int n = encode_int(out, size, len, 7, 0);
+    if (n < 0 || n + len > size)
+        return -1;
+    for (int i = 0; i < len; i++)
+        out[n + i] = lower ? tolower((unsigned char)s[i]) : s[i];
+    return n + len;
+}
+
+int hpack_encode_status(unsigned char *out, int size, int status)
+{
+    // 200, 204, 206, 304, 400, 404 and 500 are entries 8 to 14
+    static const int indexed[] = { 200, 204, 206, 304, 400, 404, 500 };
+    for (int i = 0; i < (int)(sizeof(indexed) / sizeof(indexed[0])); i++) {
+        if (indexed[i] == status)
+            return encode_int(out, size, 8 + i, 7, 0x80);
+    }
+
+    char digits[4];
+    snprintf(digits, sizeof(digits), "%03d", status);
+    int n = encode_int(out, size, 8, 4, 0x00);
+    int m = n < 0 ? -1 : encode_string(out + n, size - n, digits, 3, 0);
+    return m < 0 ? -1 : n + m;
+}
+
+int hpack_encode_header(unsigned char *out, int size, const char *name, int name_len, const char *value, int value_len)
+{
+    // the pseudo-headers take the first 14 entries, the names that follow
+    // are all different
+    int index = 0;
+    char first = tolower((unsigned char)name[0]);
+    for (int i = 14; i < HPACK_STATIC_ENTRIES; i++) {
+        const char *entry = static_table[i].name;
+        if (entry[0] == first && (int)strlen(entry) == name_len && strncasecmp(entry, name, name_len) == 0) {
+            index = i + 1;
+            break;
+        }
+    }
+
+    int n = encode_int(out, size, index, 4, 0x00);
+    if (n < 0)
+        return -1;
+    if (index == 0) {
+        int m = encode_string(out + n, size - n, name, name_len, 1);
+        if (m < 0)
+            return -1;
+        n += m;
+    }
+    int m = encode_string(out + n, size - n, value, value_len, 0);
+    return m < 0 ? -1 : n + m;
+}
@@ -1,320 +1,364 @@
-#include <netinet/in.h>
-#include <openssl/ssl.h>
-#include <pthread.h>
+#include "accesslog.h"
+#include "admission.h"
+#include "archive.h"
+#include "cache.h"
+#include "config.h"
+#include "event.h"
+#include "http.h"
+#include "tls.h"
+#include "worker.h"
+
+#include <getopt.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/socket.h>
-#include <time.h>
+#include <string.h>
 #include <unistd.h>
 
-#define HTTP_PORT 80
-#define HTTPS_PORT 443
+server_config_t config;
 
-#define OK 200
-#define NOT_FOUND 404
-#define Partial_Content 206
-#define Moved_Permanently 301
-
-typedef struct Header {
-    char *name;
-    char *value;
-    struct Header *next;
-} Header;
-
-typedef struct line {
-    char method[8];
-    char url[256];
-    char version[16];
-} Line;
-
-typedef struct Request{
-    Line line;
-    Header *headers;
-    char *body;
-} Request;
-
-void *listen_port(void *choose_port);
-void handle_https_request(SSL* ssl);
-void handle_http_request(int sock);
-void decode_request(char *raw_request, Request *request);
-
-int main()
+static void usage(const char *prog)
 {
-    pthread_t http_thread;
-    pthread_t https_thread;
-
-    int http_port = HTTP_PORT;
-    int https_port = HTTPS_PORT;
-
-    if (pthread_create(&http_thread, NULL, listen_port, &http_port)) {
-        perror("creat http thread error!\n");
-        exit(1);
-    }
-    if (pthread_create(&https_thread, NULL, listen_port, &https_port)) {
-        perror("creat https thread error!\n");
-        exit(1);
-    }
-
-    pthread_join(http_thread, NULL);
-    pthread_join(https_thread, NULL);
-
-    return 0;
+    fprintf(stderr, "usage: %s [options]\n"
+            "  -w, --workers N     worker threads, one event loop each (default: online cpus)\n"
+            "  -p, --pin           pin each worker to its own cpu\n"
+            "      --handshake-threads N\n"
+            "                      run TLS handshakes on N threads of their own, 0 runs them on\n"
+            "                      the workers, each accepting on 443 itself (default: 0)\n"
+            "  -e, --engine NAME   epoll or io_uring, io_uring falls back to epoll if the\n"
+            "                      kernel lacks it (default: epoll)\n"
+            "  -P, --plain-port N  also serve files in plaintext on port N (80 replaces the redirect)\n"
+            "  -A, --admin-port N  serve Prometheus metrics at /metrics on port N (default: off)\n"
+            "      --canonical-host HOST\n"
+            "                      host the port 80 redirects point to (default: the Host header,\n"
+            "                      " DEFAULT_REDIRECT_HOST " for HTTP/1.0 requests without a usable one)\n"
+            "      --hsts N        send Strict-Transport-Security with max-age N on https, 0 sends\n"
+            "                      none (default: 0)\n"
+            "  -L, --access-log FILE\n"
+            "                      log every request to FILE, - for stdout (default: off)\n"
+            "      --backlog N     pending connections each listener queues (default: 1024)\n"
+            "      --low-latency   TCP Fast Open and deferred accept on the listeners, needs\n"
+            "                      bit 2 of net.ipv4.tcp_fastopen for Fast Open (default: off)\n"
+            "      --no-http2      serve only HTTP/1.1 on https instead of offering h2 by ALPN\n"
+            "      --no-sendfile   copy file bodies through user space instead of sendfile()\n"
+            "      --no-ktls       keep TLS encryption in user space\n"
+            "  -b, --buffer-size N per-connection body buffer, k/m suffixes allowed (default: 128k)\n"
+            "      --session-cache N\n"
+            "                      TLS sessions kept for resumption, 0 disables (default: 20480)\n"
+            "      --ticket-rotate N\n"
+            "                      seconds between session ticket keys, 0 disables tickets (default: 3600)\n"
+            "      --archive FILE  serve the docroot packed into FILE by mkarchive instead of the\n"
+            "                      current directory, no cache and no uploads (default: off)\n"
+            "  -c, --cache-size N  memory for cached files, 0 disables the cache (default: 64m)\n"
+            "      --cache-max-entry N\n"
+            "                      largest file the cache keeps (default: 1m)\n"
+            "      --gzip-cache N  memory for gzip copies of cached files served to clients\n"
+            "                      accepting gzip, 0 disables them (default: 16m)\n"
+            "  -k, --keepalive-timeout N\n"
+            "                      seconds an idle keep-alive connection is kept, 0 disables (default: 5)\n"
+            "      --keepalive-requests N\n"
+            "                      requests served on one connection at most (default: 100)\n"
+            "      --handshake-timeout N\n"
+            "                      seconds to finish the TLS handshake (default: 10)\n"
+            "      --header-timeout N\n"
+            "                      seconds to send the whole header block of a request (default: 10)\n"
+            "      --send-timeout N\n"
+            "                      seconds a client may take to accept each piece of a response, or to\n"
+            "                      send each piece of an upload (default: 30)\n"
+            "      --max-upload N  store PUT and POST bodies of up to N bytes at the path of the url,\n"
+            "                      k/m/g suffixes allowed, 0 disables uploads (default: 0)\n"
+            "      --max-conns N   answer new connections with 503 while N are open, 0 for no limit\n"
+            "                      (default: 0)\n"
+            "      --max-conns-per-ip N\n"
+            "                      answer a client holding N connections with 503 on the next, 0 for\n"
+            "                      no limit (default: 0)\n"
+            "      --shed-queue N  answer new connections with 503 while N more wait in the accept\n"
+            "                      queue, 0 never (default: half the backlog)\n"
+            "      --shed-lag N    answer new connections with 503 while their event loop is N ms\n"
+            "                      behind on average, 0 never (default: 25)\n"
+            "      --retry-after N seconds a 503 asks the client to wait, shed TLS connections are\n"
+            "                      reset instead (default: 1)\n"
+            "  -v, --verbose       log the TLS version, cipher and tx path of each connection\n"
+            "  -h, --help          show this message\n"
+            "send SIGUSR1 to print per-worker connection counts and cache statistics\n", prog);
 }
 
-void *listen_port(void *choose_port)
+// parse a byte count with an optional k, m or g suffix
+static long parse_size(const char *arg)
 {
-    int port = *((int *)choose_port);
-
-    // init SSL Library
-	SSL_library_init();
-	OpenSSL_add_all_algorithms();
-	SSL_load_error_strings();
-
-    // enable TLS method
-	const SSL_METHOD *method = TLS_server_method();
-	SSL_CTX *ctx = SSL_CTX_new(method);
-
-	// load certificate and private key
-	if (SSL_CTX_use_certificate_file(ctx, "./keys/cnlab.cert", SSL_FILETYPE_PEM) <= 0) {
-		perror("load cert failed");
-		exit(1);
-	}
-	if (SSL_CTX_use_PrivateKey_file(ctx, "./keys/cnlab.prikey", SSL_FILETYPE_PEM) <= 0) {
-		perror("load prikey failed");
-		exit(1);
-	}
-
-    // init socket, listening to port 443
-	int sock = socket(AF_INET, SOCK_STREAM, 0);
-	if (sock < 0) {
-		perror("Opening socket failed");
-		exit(1);
-	}
-	int enable = 1;
-	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int)) < 0) {
-		perror("setsockopt(SO_REUSEADDR) failed");
-		exit(1);
-	}
-
-	struct sockaddr_in addr;
-	bzero(&addr, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = INADDR_ANY;
-	addr.sin_port = htons(port);
-
-	if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-		perror("Bind failed");
-		exit(1);
-	}
-	listen(sock, 10);
-
-	while (1) {
-		struct sockaddr_in caddr;
-		socklen_t len = sizeof(caddr);
-		int csock = accept(sock, (struct sockaddr*)&caddr, &len);
-		if (csock < 0) {
-			perror("Accept failed");
-			exit(1);
-		}
-		if(port == HTTP_PORT){
-            handle_http_request(csock);
-            close(csock);
-        }
-        if(port == HTTPS_PORT){
-            SSL *ssl = SSL_new(ctx); 
-		    SSL_set_fd(ssl, csock);
-		    handle_https_request(ssl);
-            SSL_free(ssl);
-            close(csock);
-        }
-	}
-
-	close(sock);
-	SSL_CTX_free(ctx);
-
-    return NULL;
+    char *end;
+    long size = strtol(arg, &end, 10);
+    if (*end == 'k' || *end == 'K')
+        size <<= 10;
+    else if (*end == 'm' || *end == 'M')
+        size <<= 20;
+    else if (*end == 'g' || *end == 'G')
+        size <<= 30;
+    return size;
 }
 
-void handle_http_request(int sock)
+void parse_args(int argc, char **argv)
 {
-    char *request = calloc(1024, sizeof(char));
-    char *response = calloc(1024, sizeof(char));
-    int request_len = 0;
-    int response_len = 0;
-    request_len = recv(sock, request, 1024, 0);
-
-    if (request_len < 0) {
-        perror("recv failed");
-        exit(1);
-    }
-
-    Request *http_request = calloc(1, sizeof(Request));
-    decode_request(request, http_request);
-
-    // 301 Moved Permanently
-    char new_url[256] = "https://10.0.0.1";
-    strcat(new_url, http_request->line.url);
-
-    response_len = sprintf(response, "%s %d Moved Permanently\r\nLocation: %s\r\n\r\n", http_request->line.version, Moved_Permanently, new_url);
-    // printf("%s %d Moved Permanently to %s\n", http_request->line.method, Moved_Permanently, new_url);
-    // fflush(stdout);
-
-    if (send(sock, response, response_len, 0) < 0) {
-        perror("send failed");
-        exit(1);
-    }
-}
-
-void handle_https_request(SSL* ssl)
-{   
-    char *request = calloc(1024, sizeof(char));
-    char *response = calloc(1024, sizeof(char));
-    int request_len = 0;
-    int response_len = 0;
-
-    if (SSL_accept(ssl) == -1){
-		perror("SSL_accept failed");
-		exit(1);
-	}
-
-    request_len = SSL_read(ssl, request, 1024);
-    if (request_len < 0) {
-        perror("SSL_read failed");
-        exit(1);
-    }
-
-    Request *http_request = calloc(1, sizeof(Request));
-    decode_request(request, http_request);
-
-    int option = 0; // 0: 200 OK, 1: 206 Partial Content
-    FILE *file_pointer = NULL;
-
-    for (Header *header = http_request->headers; header != NULL; header = header->next) {
-        if (strcmp(header->name, "Range") == 0) {
-            option = 1;
-            break;
-        }
-    }
-
-    // search file
-    char file_path[256] = ".";
-    char *file_path_pointer = file_path + 1;
-    strcat(file_path, http_request->line.url);
-
-    if ((file_pointer = fopen(file_path_pointer - 1, "r")) == NULL) {
-        response_len = sprintf(response, "%s %d Not Found\r\n\r\n", http_request->line.version, NOT_FOUND);
-        SSL_write(ssl, response, response_len);
-    } else {
-        if (option == 0) {
-            // 200 OK
-            fseek(file_pointer, 0, SEEK_END);
-            int file_size = ftell(file_pointer);
-            fseek(file_pointer, 0, SEEK_SET);
-
-            response_len = sprintf(response, "%s %d OK\r\nContent-Length: %d\r\n\r\n", http_request->line.version, OK, file_size);
-            // printf("%s %d OK, Content-Length: %d\n", http_request->line.method, OK, file_size);
-            // fflush(stdout);
-            SSL_write(ssl, response, response_len);
-
-            char *file_buffer = (char *)malloc(file_size);
-            fread(file_buffer, 1, file_size, file_pointer);
-            SSL_write(ssl, file_buffer, file_size);
-            printf("%s", file_buffer);
-            fflush(stdout);
-            free(file_buffer);
-        } else if (option == 1) {
-            // 206 Partial Content
-            char range_value[64];
-            for (Header *header = http_request->headers; header != NULL; header = header->next) {
-                if (strcmp(header->name, "Range") == 0) {
-                    strcpy(range_value, header->value);
-                    break;
+    static struct option options[] = {
+        { "workers",            required_argument, NULL, 'w' },
+        { "pin",                no_argument,       NULL, 'p' },
+        { "handshake-threads",  required_argument, NULL, 'Q' },
+        { "engine",             required_argument, NULL, 'e' },
+        { "plain-port",         required_argument, NULL, 'P' },
+        { "admin-port",         required_argument, NULL, 'A' },
+        { "access-log",         required_argument, NULL, 'L' },
+        { "canonical-host",     required_argument, NULL, 'N' },
+        { "hsts",               required_argument, NULL, 'Y' },
+        { "backlog",            required_argument, NULL, 'B' },
+        { "low-latency",        no_argument,       NULL, 'F' },
+        { "no-http2",           no_argument,       NULL, 'J' },
+        { "no-sendfile",        no_argument,       NULL, 'S' },
+        { "no-ktls",            no_argument,       NULL, 'K' },
+        { "buffer-size",        required_argument, NULL, 'b' },
+        { "session-cache",      required_argument, NULL, 'C' },
+        { "ticket-rotate",      required_argument, NULL, 'T' },
+        { "archive",            required_argument, NULL, 'E' },
+        { "cache-size",         required_argument, NULL, 'c' },
+        { "cache-max-entry",    required_argument, NULL, 'M' },
+        { "gzip-cache",         required_argument, NULL, 'G' },
+        { "keepalive-timeout",  required_argument, NULL, 'k' },
+        { "keepalive-requests", required_argument, NULL, 'R' },
+        { "handshake-timeout",  required_argument, NULL, 'H' },
+        { "header-timeout",     required_argument, NULL, 'D' },
+        { "send-timeout",       required_argument, NULL, 'W' },
+        { "max-upload",         required_argument, NULL, 'U' },
+        { "max-conns",          required_argument, NULL, 'X' },
+        { "max-conns-per-ip",   required_argument, NULL, 'I' },
+        { "shed-queue",         required_argument, NULL, 'O' },
+        { "shed-lag",           required_argument, NULL, 'V' },
+        { "retry-after",        required_argument, NULL, 'Z' },
+        { "verbose",            no_argument,       NULL, 'v' },
+        { "help",               no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    config.workers = sysconf(_SC_NPROCESSORS_ONLN);
+    config.pin_cpus = 0;
+    config.handshake_threads = DEFAULT_HANDSHAKE_THREADS;
+    config.engine = ENGINE_EPOLL;
+    config.plain_port = 0;
+    config.canonical_host = NULL;
+    config.hsts_max_age = 0;
+    config.backlog = LISTEN_BACKLOG;
+    config.low_latency = 0;
+    config.http2 = 1;
+    config.use_sendfile = 1;
+    config.use_ktls = 1;
+    config.buffer_size = DEFAULT_BODY_BUF_SIZE;
+    config.session_cache_size = DEFAULT_SESSION_CACHE_SIZE;
+    config.ticket_rotate = DEFAULT_TICKET_ROTATE;
+    config.archive = NULL;
+    config.cache_size = DEFAULT_CACHE_SIZE;
+    config.cache_max_entry = DEFAULT_CACHE_MAX_ENTRY;
+    config.gzip_cache_size = DEFAULT_GZIP_CACHE_SIZE;
+    config.keepalive_timeout = DEFAULT_KEEPALIVE_TIMEOUT;
+    config.keepalive_requests = DEFAULT_KEEPALIVE_REQUESTS;
+    config.handshake_timeout = DEFAULT_HANDSHAKE_TIMEOUT;
+    config.header_timeout = DEFAULT_HEADER_TIMEOUT;
+    config.send_timeout = DEFAULT_SEND_TIMEOUT;
+    config.max_upload = 0;
+    config.max_conns = 0;
+    config.max_conns_per_ip = 0;
+    config.shed_queue = -1;
+    config.shed_lag = DEFAULT_SHED_LAG;
+    config.retry_after = DEFAULT_RETRY_AFTER;
+    config.verbose = 0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "w:pe:P:A:L:b:c:k:vh", options, NULL)) != -1) {
+        switch (opt) {
+            case 'w':
+                config.workers = atoi(optarg);
+                break;
+            case 'p':
+                config.pin_cpus = 1;
+                break;
+            case 'Q':
+                config.handshake_threads = atoi(optarg);
+                break;
+            case 'e':
+                if (strcmp(optarg, "io_uring") == 0 || strcmp(optarg, "uring") == 0) {
+                    config.engine = ENGINE_URING;
+                } else if (strcmp(optarg, "epoll") == 0) {
+                    config.engine = ENGINE_EPOLL;
+                } else {
+                    usage(argv[0]);
+                    exit(1);
                 }
-            }
-
-            int start, end;
-            if (sscanf(range_value, "bytes=%d-%d", &start, &end) != 2) {
-                sscanf(range_value, "bytes=%d-", &start);
-                end = -1;
-            }
-
-            fseek(file_pointer, 0, SEEK_END);
-            int file_size = ftell(file_pointer);
-            if (end == -1 || end >= file_size) {
-                end = file_size - 1;
-            }
-            int content_length = end - start + 1;
-            fseek(file_pointer, start, SEEK_SET);
-
-            response_len = sprintf(response, "%s %d Partial Content\r\nContent-Length: %d\r\nContent-Range: bytes %d-%d/%d\r\n\r\n", http_request->line.version, Partial_Content, content_length, start, end, file_size);
-            // printf("%s %d Partial Content, Content-Length: %d, Content-Range: bytes %d-%d/%d\n", http_request->line.method, Partial_Content, content_length, start, end, file_size);
-            // fflush(stdout);
-            SSL_write(ssl, response, response_len);
-
-            char *file_buffer = (char *)malloc(content_length);
-            fread(file_buffer, 1, content_length, file_pointer);
-            SSL_write(ssl, file_buffer, content_length);
-            free(file_buffer);
+                break;
+            case 'P':
+                config.plain_port = atoi(optarg);
+                break;
+            case 'A':
+                config.admin_port = atoi(optarg);
+                break;
+            case 'L':
+                config.access_log = optarg;
+                break;
+            case 'N':
+                config.canonical_host = optarg;
+                break;
+            case 'Y':
+                config.hsts_max_age = atoi(optarg);
+                break;
+            case 'B':
+                config.backlog = atoi(optarg);
+                break;
+            case 'F':
+                config.low_latency = 1;
+                break;
+            case 'J':
+                config.http2 = 0;
+                break;
+            case 'S':
+                config.use_sendfile = 0;
+                break;
+            case 'K':
+                config.use_ktls = 0;
+                break;
+            case 'b':
+                config.buffer_size = parse_size(optarg);
+                break;
+            case 'C':
+                config.session_cache_size = atoi(optarg);
+                break;
+            case 'T':
+                config.ticket_rotate = atoi(optarg);
+                break;
+            case 'c':
+                config.cache_size = parse_size(optarg);
+                break;
+            case 'M':
+                config.cache_max_entry = parse_size(optarg);
+                break;
+            case 'G':
+                config.gzip_cache_size = parse_size(optarg);
+                break;
+            case 'k':
+                config.keepalive_timeout = atoi(optarg);
+                break;
+            case 'R':
+                config.keepalive_requests = atoi(optarg);
+                break;
+            case 'H':
+                config.handshake_timeout = atoi(optarg);
+                break;
+            case 'D':
+                config.header_timeout = atoi(optarg);
+                break;
+            case 'W':
+                config.send_timeout = atoi(optarg);
+                break;
+            case 'E':
+                config.archive = optarg;
+                break;
+            case 'U':
+                config.max_upload = parse_size(optarg);
+                break;
+            case 'X':
+                config.max_conns = atoi(optarg);
+                break;
+            case 'I':
+                config.max_conns_per_ip = atoi(optarg);
+                break;
+            case 'O':
+                config.shed_queue = atoi(optarg);
+                break;
+            case 'V':
+                config.shed_lag = atoi(optarg);
+                break;
+            case 'Z':
+                config.retry_after = atoi(optarg);
+                break;
+            case 'v':
+                config.verbose = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(opt == 'h' ? 0 : 1);
         }
-        fclose(file_pointer);
     }
 
-    return;
+    if (config.workers <= 0)
+        config.workers = 1;
+    if (config.handshake_threads < 0)
+        config.handshake_threads = 0;
+    if (config.backlog <= 0)
+        config.backlog = LISTEN_BACKLOG;
+    if (config.buffer_size < MIN_BODY_BUF_SIZE)
+        config.buffer_size = MIN_BODY_BUF_SIZE;
+    if (config.buffer_size > MAX_BODY_BUF_SIZE)
+        config.buffer_size = MAX_BODY_BUF_SIZE;
+    // the archive is read-only, and the cache would only copy it
+    if (config.max_upload < 0 || config.archive)
+        config.max_upload = 0;
+    if (config.archive)
+        config.cache_size = 0;
+    if (config.shed_queue < 0)
+        config.shed_queue = config.backlog / 2;
+    if (config.retry_after < 0)
+        config.retry_after = 0;
 }
 
-void decode_request(char *raw_request, Request *request)
+// Fast Open on a listener is silently ignored unless the server bit of the
+// sysctl is set
+static void check_fastopen(void)
 {
-    char *line_end = strstr(raw_request, "\r\n");
-    sscanf(raw_request, "%s %s %s", request->line.method, request->line.url, request->line.version);
-
-    char *header_start = line_end + 2;
-    char *header_end;
-    Header *current_header = NULL;
-
-    while ((header_end = strstr(header_start, "\r\n")) != NULL && header_end != header_start) {
-        Header *new_header = (Header *)malloc(sizeof(Header));
-        new_header->next = NULL;
-
-        char *colon_pos = strstr(header_start, ": ");
-        if (colon_pos != NULL) {
-            int name_len = colon_pos - header_start;
-            int value_len = header_end - (colon_pos + 2);
-
-            new_header->name = (char *)malloc(name_len + 1);
-            new_header->value = (char *)malloc(value_len + 1);
-
-            strncpy(new_header->name, header_start, name_len);
-            new_header->name[name_len] = '\0';
-            strncpy(new_header->value, colon_pos + 2, value_len);
-            new_header->value[value_len] = '\0';
-
-            if (current_header == NULL) {
-                request->headers = new_header;
-            } else {
-                current_header->next = new_header;
-            }
-            current_header = new_header;
-        }
-
-        header_start = header_end + 2;
+    int mode = 0;
+    FILE *f = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+    if (f) {
+        if (fscanf(f, "%d", &mode) != 1)
+            mode = 0;
+        fclose(f);
     }
+    if (!(mode & 2))
+        fprintf(stderr, "net.ipv4.tcp_fastopen is %d, TCP Fast Open stays off for the listeners "
+                "until bit 2 is set\n", mode);
+}
 
-    if (strcmp(request->line.method, "POST") == 0) {
-        request->body = strdup(header_start);
-    } else {
-        request->body = NULL;
+int main(int argc, char **argv)
+{
+    parse_args(argc, argv);
+    if (config.low_latency)
+        check_fastopen();
+    init_end_headers();
+
+    // a client that goes away must not kill the whole server
+    signal(SIGPIPE, SIG_IGN);
+
+    // only the main thread handles signals, the workers inherit the mask
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    init_ssl_ctx();
+    if (config.archive && open_archive(config.archive) < 0)
+        exit(1);
+    init_cache(config.cache_size, config.cache_max_entry, config.gzip_cache_size, ".");
+    start_workers(config.workers, config.pin_cpus);
+    if (config.handshake_threads > 0)
+        start_handshake_pool(config.handshake_threads);
+    if (config.access_log)
+        start_access_log(config.access_log);
+
+    while (1) {
+        int sig;
+        if (sigwait(&set, &sig) != 0)
+            continue;
+        dump_worker_stats();
+        dump_cache_stats();
+        if (sig != SIGUSR1)
+            break;
     }
+    stop_access_log();
 
-    // printf("Method: %s, URL: %s, Version: %s\n", request->line.method, request->line.url, request->line.version);
-    // fflush(stdout);
-    // for (Header *header = request->headers; header != NULL; header = header->next) {
-    //     printf("Header: %s: %s\n", header->name, header->value);
-    //     fflush(stdout);
-    // }
-    // if (request->body != NULL) {
-    //     printf("Body: %s\n", request->body);
-    //     fflush(stdout);
-    // }
-    // printf("\n");
-    // return;
-}
\ No newline at end of file
+    return 0;
+}
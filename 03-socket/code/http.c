@@ -0,0 +1,835 @@
+#include "archive.h"
+#include "cache.h"
+#include "config.h"
+#include "event.h"
+#include "http.h"
+#include "metrics.h"
+#include "upload.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// HTTP/1.1 keeps the connection unless told to close, HTTP/1.0 only when asked
+// to. Requests carrying a body are not kept since the body is not consumed,
+// unless it is read as an upload.
+static int want_keep_alive(conn_t *conn)
+{
+    http_parser_t *parser = &conn->parser;
+
+    if (config.keepalive_timeout <= 0 || conn->requests >= config.keepalive_requests)
+        return 0;
+    if (conn->upload == NULL && (find_header(parser, conn->request, "Content-Length")
+            || find_header(parser, conn->request, "Transfer-Encoding")))
+        return 0;
+
+    const http_header_t *connection = find_header(parser, conn->request, "Connection");
+    if (view_equals(conn->request, parser->version, "HTTP/1.1"))
+        return connection == NULL || !view_has_token(conn->request, connection->value, "close");
+    if (view_equals(conn->request, parser->version, "HTTP/1.0"))
+        return connection != NULL && view_has_token(conn->request, connection->value, "keep-alive");
+    return 0;
+}
+
+// the last headers of every response: Connection, and on https the HSTS
+// policy in front of it, rendered once at startup along with the 503 of a
+// shed request
+static const char end_keep_alive[] = "Connection: keep-alive\r\n";
+static const char end_close[] = "Connection: close\r\n";
+static char end_keep_alive_tls[128], end_close_tls[128];
+static char overload[256];
+static int overload_len;
+
+void init_end_headers(void)
+{
+    if (config.hsts_max_age > 0) {
+        snprintf(end_keep_alive_tls, sizeof(end_keep_alive_tls), "Strict-Transport-Security: max-age=%d\r\n%s",
+                config.hsts_max_age, end_keep_alive);
+        snprintf(end_close_tls, sizeof(end_close_tls), "Strict-Transport-Security: max-age=%d\r\n%s",
+                config.hsts_max_age, end_close);
+    } else {
+        strcpy(end_keep_alive_tls, end_keep_alive);
+        strcpy(end_close_tls, end_close);
+    }
+
+    overload_len = snprintf(overload, sizeof(overload), "HTTP/1.1 %d Service Unavailable\r\nRetry-After: %d\r\n"
+            "Content-Length: 0\r\n%s\r\n", SERVICE_UNAVAILABLE, config.retry_after, end_close);
+}
+
+static const char *end_headers(conn_t *conn)
+{
+    if (conn->ssl)
+        return conn->keep_alive ? end_keep_alive_tls : end_close_tls;
+    return conn->keep_alive ? end_keep_alive : end_close;
+}
+
+// length of the name in a Host header, the port left out, -1 if it is not a
+// name or address a Location can be built from
+static int host_name_len(const char *host, int len)
+{
+    int end = len;
+    if (len > 0 && host[0] == '[') {
+        const char *bracket = memchr(host, ']', len);
+        if (bracket == NULL)
+            return -1;
+        end = bracket - host + 1;
+    } else {
+        const char *colon = memchr(host, ':', len);
+        if (colon)
+            end = colon - host;
+    }
+    if (end == 0 || end > MAX_HOST_LEN || (end < len && host[end] != ':'))
+        return -1;
+
+    for (int i = 0; i < end; i++) {
+        char c = host[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                c == '.' || c == '-' || c == '[' || c == ']' || c == ':'))
+            return -1;
+    }
+    return end;
+}
+
+void handle_http_request(conn_t *conn)
+{
+    http_parser_t *parser = &conn->parser;
+
+    // the location has to fit the response buffer
+    if (parser->url.len > MAX_REDIRECT_URL) {
+        handle_bad_request(conn, URI_TOO_LONG);
+        return;
+    }
+
+    // the configured host, or the one the client asked for. HTTP/1.1 has
+    // to send a usable Host, HTTP/1.0 need not and gets the default one.
+    const char *host = config.canonical_host;
+    int host_len = host ? (int)strlen(host) : -1;
+    if (host == NULL) {
+        const http_header_t *header = find_header(parser, conn->request, "Host");
+        if (header) {
+            host = conn->request + header->value.off;
+            host_len = host_name_len(host, header->value.len);
+        }
+        if (host_len < 0 && view_equals(conn->request, parser->version, "HTTP/1.1")) {
+            handle_bad_request(conn, BAD_REQUEST);
+            return;
+        }
+        if (host_len < 0) {
+            host = DEFAULT_REDIRECT_HOST;
+            host_len = strlen(host);
+        }
+    }
+    conn->keep_alive = want_keep_alive(conn);
+
+    // 301 Moved Permanently
+    conn->status = Moved_Permanently;
+    conn->response_len = snprintf(conn->response, RESPONSE_BUF_SIZE, "%.*s %d Moved Permanently\r\nLocation: https://%.*s%.*s\r\nContent-Length: 0\r\n%s\r\n",
+            parser->version.len, conn->request + parser->version.off, Moved_Permanently,
+            host_len, host, parser->url.len, conn->request + parser->url.off, end_headers(conn));
+    if (conn->response_len >= RESPONSE_BUF_SIZE)
+        handle_bad_request(conn, URI_TOO_LONG);
+}
+
+// answer a request that could not be parsed or is too large and drop the
+// connection, since where the next request would start is unknown
+void handle_bad_request(conn_t *conn, int status)
+{
+    const char *reason = "Bad Request";
+    if (status == URI_TOO_LONG)
+        reason = "URI Too Long";
+    else if (status == HEADERS_TOO_LARGE)
+        reason = "Request Header Fields Too Large";
+
+    conn->keep_alive = 0;
+    conn->status = status;
+    conn->response_len = snprintf(conn->response, RESPONSE_BUF_SIZE, "HTTP/1.1 %d %s\r\nContent-Length: 0\r\n%s\r\n",
+            status, reason, end_headers(conn));
+}
+
+// a Content-Length value, -1 unless it is all digits and sane
+static off_t parse_length(const char *value, int len)
+{
+    off_t length = 0;
+    if (len == 0 || len > 18)
+        return -1;
+    for (int i = 0; i < len; i++) {
+        if (value[i] < '0' || value[i] > '9')
+            return -1;
+        length = length * 10 + value[i] - '0';
+    }
+    return length;
+}
+
+static const char *upload_reason(int status)
+{
+    switch (status) {
+        case CREATED: return "Created";
+        case NO_CONTENT: return "No Content";
+        case BAD_REQUEST: return "Bad Request";
+        case FORBIDDEN: return "Forbidden";
+        case NOT_FOUND: return "Not Found";
+        case CONFLICT: return "Conflict";
+        case PAYLOAD_TOO_LARGE: return "Content Too Large";
+        case NOT_IMPLEMENTED: return "Not Implemented";
+        default: return "Internal Server Error";
+    }
+}
+
+// PUT or POST with uploads enabled: the body is framed by a Content-Length or
+// chunked, empty without either unless the transport frames it (HTTP/2). It
+// has to fit the limit and its path has to be in an existing directory, then
+// it is read in a state of its own.
+void handle_upload_request(conn_t *conn, int framed)
+{
+    http_parser_t *parser = &conn->parser;
+    const http_header_t *length = find_header(parser, conn->request, "Content-Length");
+    const http_header_t *coding = find_header(parser, conn->request, "Transfer-Encoding");
+    off_t content_length = framed ? -1 : 0;
+    int status = 0;
+
+    if (coding) {
+        // both at once is how requests are smuggled past a proxy
+        if (length)
+            status = BAD_REQUEST;
+        else if (!view_case_equals(conn->request, coding->value, "chunked"))
+            status = NOT_IMPLEMENTED;
+    } else if (length && (content_length = parse_length(conn->request + length->value.off, length->value.len)) < 0) {
+        status = BAD_REQUEST;
+    } else if (content_length > config.max_upload) {
+        status = PAYLOAD_TOO_LARGE;
+    }
+
+    char url[256];
+    if (status == 0 && normalize_url(conn->request + parser->url.off, parser->url.len, url, sizeof(url)) < 0)
+        status = NOT_FOUND;
+    if (status == 0)
+        status = start_upload(conn, url, coding != NULL, content_length);
+    if (status) {
+        handle_upload_done(conn, status);
+        return;
+    }
+    conn->keep_alive = want_keep_alive(conn);
+
+    // a client asking for 100 Continue holds the body back until it comes,
+    // unless it sent some of it anyway
+    const http_header_t *expect = find_header(parser, conn->request, "Expect");
+    if (!framed && expect && view_case_equals(conn->request, expect->value, "100-continue")
+            && view_equals(conn->request, parser->version, "HTTP/1.1") && conn->request_end == conn->request_len)
+        conn->response_len = sprintf(conn->response, "HTTP/1.1 %d Continue\r\n\r\n", CONTINUE);
+}
+
+// the final response of an upload, after a failure the rest of the body is
+// not read and the connection is not kept
+void handle_upload_done(conn_t *conn, int status)
+{
+    http_parser_t *parser = &conn->parser;
+
+    if (status != CREATED && status != NO_CONTENT)
+        conn->keep_alive = 0;
+    conn->status = status;
+    conn->response_sent = 0;
+    conn->response_len = sprintf(conn->response, "%.*s %d %s\r\n%s%s\r\n", parser->version.len, conn->request + parser->version.off,
+            status, upload_reason(status), status == NO_CONTENT ? "" : "Content-Length: 0\r\n", end_headers(conn));
+}
+
+// a HEAD is answered with the headers a GET would get and no body, on a
+// kept-alive connection the body would be taken for the next response
+static int head_only(conn_t *conn)
+{
+    return view_equals(conn->request, conn->parser.method, "HEAD");
+}
+
+// point the response body at length bytes starting at offset, taken from the
+// cached or archived copy when there is one and streamed from the file
+// otherwise
+static void set_body(conn_t *conn, off_t offset, off_t length)
+{
+    if (conn->cache_data) {
+        conn->body = conn->cache_data + offset;
+        conn->body_len = length;
+    } else {
+        conn->file_offset = offset;
+        conn->file_left = length;
+    }
+}
+
+// a file found for a url, either a referenced cache entry, an open file or
+// one packed in the archive
+typedef struct file_ref {
+    cache_entry_t *entry;
+    int fd;
+    const archive_file_t *archived;
+    off_t size;
+    ino_t ino;
+    time_t mtime;
+    long mtime_nsec;
+} file_ref_t;
+
+// look up a regular file, in the archive when serving one, else the cache
+// first. Returns -1 if there is none.
+static int find_file(const char *url, file_ref_t *file)
+{
+    unsigned long generation;
+
+    file->fd = -1;
+    file->entry = NULL;
+    file->archived = NULL;
+    if (is_upload_part(url))
+        return -1;
+    if (config.archive) {
+        file->archived = archive_lookup(url, strlen(url));
+        if (file->archived == NULL)
+            return -1;
+        file->size = file->archived->size;
+        file->ino = file->archived->ino;
+        file->mtime = file->archived->mtime;
+        file->mtime_nsec = file->archived->mtime_nsec;
+        return 0;
+    }
+
+    file->entry = cache_lookup(url, &generation);
+    if (file->entry) {
+        file->size = file->entry->size;
+        file->ino = file->entry->ino;
+        file->mtime = file->entry->mtime;
+        file->mtime_nsec = file->entry->mtime_nsec;
+        return 0;
+    }
+
+    char file_path[512] = ".";
+    strcat(file_path, url);
+
+    struct stat st;
+    int fd = open(file_path, O_RDONLY);
+    if (fd >= 0 && (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))) {
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0)
+        return -1;
+
+    file->size = st.st_size;
+    file->ino = st.st_ino;
+    file->mtime = st.st_mtim.tv_sec;
+    file->mtime_nsec = st.st_mtim.tv_nsec;
+    file->entry = cache_load(url, fd, &st, generation);
+    if (file->entry)
+        close(fd);
+    else
+        file->fd = fd;
+    return 0;
+}
+
+static void put_file(file_ref_t *file)
+{
+    if (file->entry)
+        cache_release(file->entry);
+    if (file->fd >= 0)
+        close(file->fd);
+}
+
+enum content_coding {
+    CODING_IDENTITY,
+    CODING_GZIP,
+    CODING_BR,
+};
+
+static const char *coding_names[] = { NULL, "gzip", "br" };
+static const char *sidecar_suffixes[] = { NULL, ".gz", ".br" };
+
+// pick the representation to send: a precompressed sidecar (.br over .gz)
+// at least as new as the file, else the gzip copy kept with the cached file.
+// file is swapped for the sidecar when one is used, *gzip_copy is set when
+// the cached copy is. Returns the content coding.
+static int negotiate_coding(conn_t *conn, const char *url, file_ref_t *file, int *gzip_copy)
+{
+    const http_header_t *accept = find_header(&conn->parser, conn->request, "Accept-Encoding");
+
+    *gzip_copy = 0;
+    if (accept == NULL)
+        return CODING_IDENTITY;
+
+    for (int coding = CODING_BR; coding > CODING_IDENTITY; coding--) {
+        if (!view_accepts(conn->request, accept->value, coding_names[coding]))
+            continue;
+
+        // an entry remembers that it has no sidecar, until one shows up
+        if (file->entry == NULL || !(file->entry->no_sidecar & (1 << coding))) {
+            char sidecar_url[512];
+            file_ref_t sidecar;
+            snprintf(sidecar_url, sizeof(sidecar_url), "%s%s", url, sidecar_suffixes[coding]);
+            if (find_file(sidecar_url, &sidecar) == 0) {
+                if (sidecar.mtime >= file->mtime) {
+                    put_file(file);
+                    *file = sidecar;
+                    return coding;
+                }
+                put_file(&sidecar);
+            } else if (file->entry) {
+                __atomic_or_fetch(&file->entry->no_sidecar, 1 << coding, __ATOMIC_RELAXED);
+            }
+        }
+
+        if (coding == CODING_GZIP && ((file->entry && cache_gzip(file->entry) == 0) ||
+                (file->archived && file->archived->gzip_size > 0))) {
+            *gzip_copy = 1;
+            return coding;
+        }
+    }
+
+    return CODING_IDENTITY;
+}
+
+// a strong validator that changes whenever the file is replaced or written,
+// the gzip copy is a representation of its own
+static void make_etag(file_ref_t *file, int gzip_copy, char *etag, int size)
+{
+    snprintf(etag, size, "\"%lx-%llx-%llx%s\"", (unsigned long)file->ino,
+            (unsigned long long)file->size,
+            (unsigned long long)file->mtime * 1000000000ULL + file->mtime_nsec,
+            gzip_copy ? "-gzip" : "");
+}
+
+static void http_date(time_t t, char *buf, int size)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// parse an IMF-fixdate, returns -1 if it is not one
+static time_t parse_http_date(const char *buf, str_view_t view)
+{
+    char date[64];
+    struct tm tm;
+
+    if (view.len >= (int)sizeof(date))
+        return -1;
+    memcpy(date, buf + view.off, view.len);
+    date[view.len] = '\0';
+
+    memset(&tm, 0, sizeof(tm));
+    char *end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == NULL || *end != '\0')
+        return -1;
+    return timegm(&tm);
+}
+
+// whether the list of entity-tags holds etag, or is "*". The weak comparison
+// of If-None-Match ignores W/ prefixes, the strong one of If-Range never
+// matches a weak tag.
+static int etag_matches(const char *buf, str_view_t view, const char *etag, int weak)
+{
+    int etag_len = strlen(etag);
+    const char *p = buf + view.off;
+    const char *end = p + view.len;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if (p < end && *p == '*')
+            return 1;
+
+        int is_weak = end - p >= 2 && p[0] == 'W' && p[1] == '/';
+        if (is_weak)
+            p += 2;
+        const char *start = p;
+        if (p < end && *p == '"') {
+            for (p++; p < end && *p != '"'; p++)
+                ;
+            if (p < end)
+                p++;
+        }
+        if (p - start == etag_len && memcmp(start, etag, etag_len) == 0 && (weak || !is_weak))
+            return 1;
+        while (p < end && *p != ',')
+            p++;
+    }
+    return 0;
+}
+
+// evaluate If-None-Match, or If-Modified-Since without it, returns 1 if the
+// client's copy is current
+static int not_modified(conn_t *conn, const char *etag, time_t mtime)
+{
+    const http_header_t *header = find_header(&conn->parser, conn->request, "If-None-Match");
+    if (header)
+        return etag_matches(conn->request, header->value, etag, 1);
+
+    header = find_header(&conn->parser, conn->request, "If-Modified-Since");
+    if (header) {
+        time_t since = parse_http_date(conn->request, header->value);
+        return since >= 0 && mtime <= since;
+    }
+    return 0;
+}
+
+// a range only applies to the version named by If-Range, otherwise the whole
+// file is sent so a resumed download is not stitched from two versions
+static int if_range_matches(conn_t *conn, const char *etag, time_t mtime)
+{
+    const http_header_t *header = find_header(&conn->parser, conn->request, "If-Range");
+    if (header == NULL)
+        return 1;
+
+    const char *value = conn->request + header->value.off;
+    if (header->value.len > 0 && (value[0] == '"' || value[0] == 'W'))
+        return etag_matches(conn->request, header->value, etag, 0);
+    return parse_http_date(conn->request, header->value) == mtime;
+}
+
+// parse a Range header against a file of size bytes into sorted, coalesced
+// ranges. Returns the number of ranges, 0 if none of them can be satisfied or
+// -1 if the header is to be ignored and the whole file sent: it is malformed,
+// not in bytes, or asks for too many pieces.
+int parse_ranges(const char *value, int len, off_t size, byte_range_t *ranges)
+{
+    struct { long long first, last; } specs[MAX_RANGE_SPECS];
+    int nspecs = 0;
+    const char *p = value, *end = value + len;
+
+    if (len < 6 || strncasecmp(p, "bytes=", 6) != 0)
+        return -1;
+    p += 6;
+
+    while (p < end) {
+        if (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+            continue;
+        }
+        if (nspecs == MAX_RANGE_SPECS)
+            return -1;
+
+        // first-pos "-" [ last-pos ], or "-" suffix-length, -1 when absent
+        long long num[2] = { -1, -1 };
+        for (int i = 0; i < 2; i++) {
+            if (p < end && *p >= '0' && *p <= '9') {
+                num[i] = 0;
+                for (; p < end && *p >= '0' && *p <= '9'; p++) {
+                    if (num[i] > (LLONG_MAX - 9) / 10)
+                        return -1;
+                    num[i] = num[i] * 10 + *p - '0';
+                }
+            }
+            if (i == 0 && (p == end || *p++ != '-'))
+                return -1;
+        }
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if ((p < end && *p != ',') || (num[0] < 0 && num[1] < 0)
+                || (num[0] >= 0 && num[1] >= 0 && num[1] < num[0]))
+            return -1;
+
+        specs[nspecs].first = num[0];
+        specs[nspecs].last = num[1];
+        nspecs++;
+    }
+    if (nspecs == 0)
+        return -1;
+
+    // resolve against the file size, dropping what lies beyond it
+    byte_range_t resolved[MAX_RANGE_SPECS];
+    int n = 0;
+    for (int i = 0; i < nspecs; i++) {
+        off_t start, last;
+        if (specs[i].first < 0) {
+            if (specs[i].last == 0 || size == 0)
+                continue;
+            start = specs[i].last >= size ? 0 : size - specs[i].last;
+            last = size - 1;
+        } else {
+            if (specs[i].first >= size)
+                continue;
+            start = specs[i].first;
+            last = specs[i].last < 0 || specs[i].last >= size ? size - 1 : specs[i].last;
+        }
+
+        // keep them sorted by start
+        int j = n++;
+        for (; j > 0 && resolved[j - 1].start > start; j--)
+            resolved[j] = resolved[j - 1];
+        resolved[j].start = start;
+        resolved[j].end = last;
+    }
+
+    // merge overlapping, adjacent and nearly adjacent ranges
+    int nranges = 0;
+    for (int i = 0; i < n; i++) {
+        if (nranges > 0 && resolved[i].start <= ranges[nranges - 1].end + 1 + RANGE_COALESCE_GAP) {
+            if (resolved[i].end > ranges[nranges - 1].end)
+                ranges[nranges - 1].end = resolved[i].end;
+            continue;
+        }
+        if (nranges == MAX_RANGES)
+            return -1;
+        ranges[nranges++] = resolved[i];
+    }
+
+    return nranges;
+}
+
+// delimiter and headers in front of part i of a multipart/byteranges body,
+// or the closing delimiter when i is nranges
+static int render_part_header(conn_t *conn, int i, off_t size, char *buf, int buf_size)
+{
+    const char *crlf = i == 0 ? "" : "\r\n";
+
+    if (i == conn->nranges)
+        return snprintf(buf, buf_size, "\r\n--%s--\r\n", conn->boundary);
+    return snprintf(buf, buf_size, "%s--%s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+            crlf, conn->boundary, (long long)conn->ranges[i].start,
+            (long long)conn->ranges[i].end, (long long)size);
+}
+
+// queue the next part of a multipart/byteranges body once the previous one is
+// out: its headers go through the response buffer, its bytes are sent like
+// any other body. Returns 0 when there is nothing left to send.
+int next_range_part(conn_t *conn)
+{
+    if (conn->nranges == 0 || conn->next_range > conn->nranges)
+        return 0;
+
+    int i = conn->next_range++;
+    conn->response_len = render_part_header(conn, i, conn->file_size, conn->response, RESPONSE_BUF_SIZE);
+    conn->response_sent = 0;
+    conn->body_sent = 0;
+    if (i < conn->nranges)
+        set_body(conn, conn->ranges[i].start, conn->ranges[i].end - conn->ranges[i].start + 1);
+    else
+        set_body(conn, 0, 0);
+
+    return 1;
+}
+
+void handle_file_request(conn_t *conn)
+{
+    char *response = conn->response;
+    int response_len = 0;
+
+    http_parser_t *parser = &conn->parser;
+    int version_len = parser->version.len;
+    const char *version = conn->request + parser->version.off;
+    conn->keep_alive = want_keep_alive(conn);
+
+    int no_body = head_only(conn);
+    int option = 0; // 0: 200 OK, 1: 206 Partial Content, 2: 416 Range Not Satisfiable, 3: 304 Not Modified
+
+    const http_header_t *range = find_header(parser, conn->request, "Range");
+
+    // search file, the cache first
+    char url[256];
+    off_t file_size = 0;
+    int found = 0;
+    file_ref_t file;
+
+    if (normalize_url(conn->request + parser->url.off, parser->url.len, url, sizeof(url)) >= 0)
+        found = find_file(url, &file) == 0;
+
+    if (!found) {
+        response_len = sprintf(response, "%.*s %d Not Found\r\nContent-Length: 0\r\n%s\r\n", version_len, version, NOT_FOUND, end_headers(conn));
+    } else {
+        // the representation is picked before ranges apply, so they always
+        // refer to the bytes of the encoded body
+        char coding_header[64] = "";
+        const char *vary_header = "";
+        int coding = CODING_IDENTITY, gzip_copy = 0;
+        off_t identity_size = file.size;
+        if (compressible(url)) {
+            coding = negotiate_coding(conn, url, &file, &gzip_copy);
+            if (coding != CODING_IDENTITY) {
+                snprintf(coding_header, sizeof(coding_header), "Content-Encoding: %s\r\nVary: Accept-Encoding\r\n", coding_names[coding]);
+            } else {
+                strcpy(coding_header, "Vary: Accept-Encoding\r\n");
+            }
+            vary_header = "Vary: Accept-Encoding\r\n";
+        }
+
+        conn->cache_entry = file.entry;
+        conn->file_fd = file.fd;
+        file_size = file.size;
+        if (file.entry)
+            conn->cache_data = file.entry->data;
+        else if (file.archived)
+            conn->cache_data = archive_at(file.archived->data_off);
+        if (gzip_copy && file.entry) {
+            conn->cache_data = file.entry->gzip;
+            file_size = file.entry->gzip_size;
+        } else if (gzip_copy) {
+            conn->cache_data = archive_at(file.archived->gzip_off);
+            file_size = file.archived->gzip_size;
+        }
+
+        // validators of the representation being sent
+        char etag[64], last_modified[32], validators[128];
+        make_etag(&file, gzip_copy, etag, sizeof(etag));
+        http_date(file.mtime, last_modified, sizeof(last_modified));
+        snprintf(validators, sizeof(validators), "ETag: %s\r\nLast-Modified: %s\r\n", etag, last_modified);
+
+        if (not_modified(conn, etag, file.mtime))
+            option = 3;
+        else if (range != NULL && !if_range_matches(conn, etag, file.mtime))
+            range = NULL;
+
+        conn->file_size = file_size;
+        if (range != NULL && option != 3) {
+            int n = parse_ranges(conn->request + range->value.off, range->value.len, file_size, conn->ranges);
+            // a multipart body has no single content coding, send all of it
+            if (n > 1 && coding != CODING_IDENTITY)
+                n = -1;
+            if (n == 0)
+                option = 2;
+            else if (n > 0)
+                option = 1;
+            conn->nranges = n > 1 ? n : 0;
+        }
+        // savings only count once a body goes out, not on a 416 or a HEAD
+        if ((option == 0 || option == 1) && !no_body && coding != CODING_IDENTITY)
+            cache_count_encoded(identity_size, file_size);
+
+        if (option == 0) {
+            // 200 OK
+            if (file.archived) {
+                // packed with its validators
+                int header_len = gzip_copy ? file.archived->gzip_header_len : file.archived->header_len;
+                response_len = sprintf(response, "%.*s %d OK\r\n", version_len, version, OK);
+                memcpy(response + response_len, archive_at(gzip_copy ? file.archived->gzip_header_off : file.archived->header_off), header_len);
+                response_len += header_len;
+                response_len += sprintf(response + response_len, "%s%s\r\n", coding_header, end_headers(conn));
+            } else if (conn->cache_entry && conn->cache_data == conn->cache_entry->data) {
+                response_len = sprintf(response, "%.*s %d OK\r\n", version_len, version, OK);
+                memcpy(response + response_len, conn->cache_entry->header, conn->cache_entry->header_len);
+                response_len += conn->cache_entry->header_len;
+                response_len += sprintf(response + response_len, "%s%s%s\r\n", validators, coding_header, end_headers(conn));
+            } else {
+                response_len = sprintf(response, "%.*s %d OK\r\nContent-Length: %lld\r\n%s%s%s\r\n", version_len, version, OK, (long long)file_size, validators, coding_header, end_headers(conn));
+            }
+            if (!no_body)
+                set_body(conn, 0, file_size);
+        } else if (option == 1) {
+            // 206 Partial Content
+            if (conn->nranges == 0) {
+                long long start = conn->ranges[0].start, end = conn->ranges[0].end;
+                long long content_length = end - start + 1;
+
+                response_len = sprintf(response, "%.*s %d Partial Content\r\nContent-Length: %lld\r\nContent-Range: bytes %lld-%lld/%lld\r\n%s%s%s\r\n", version_len, version, Partial_Content, content_length, start, end, (long long)file_size, validators, coding_header, end_headers(conn));
+                if (!no_body)
+                    set_body(conn, start, content_length);
+            } else {
+                // multipart/byteranges, the length covers every part header
+                static unsigned long boundaries;
+                snprintf(conn->boundary, sizeof(conn->boundary), "%020lu",
+                        __atomic_add_fetch(&boundaries, 1, __ATOMIC_RELAXED));
+
+                char part[128];
+                long long content_length = 0;
+                for (int i = 0; i <= conn->nranges; i++) {
+                    content_length += render_part_header(conn, i, file_size, part, sizeof(part));
+                    if (i < conn->nranges)
+                        content_length += conn->ranges[i].end - conn->ranges[i].start + 1;
+                }
+
+                response_len = sprintf(response, "%.*s %d Partial Content\r\nContent-Type: multipart/byteranges; boundary=%s\r\nContent-Length: %lld\r\n%s%s%s\r\n", version_len, version, Partial_Content, conn->boundary, content_length, validators, coding_header, end_headers(conn));
+
+                if (no_body) {
+                    conn->nranges = 0;
+                } else {
+                    // the first part header goes out with the response headers
+                    response_len += render_part_header(conn, 0, file_size, response + response_len, RESPONSE_BUF_SIZE - response_len);
+                    conn->next_range = 1;
+                    set_body(conn, conn->ranges[0].start, conn->ranges[0].end - conn->ranges[0].start + 1);
+                }
+            }
+        } else if (option == 2) {
+            // 416 Range Not Satisfiable
+            response_len = sprintf(response, "%.*s %d Range Not Satisfiable\r\nContent-Range: bytes */%lld\r\nContent-Length: 0\r\n%s%s\r\n", version_len, version, RANGE_NOT_SATISFIABLE, (long long)file_size, vary_header, end_headers(conn));
+        } else if (option == 3) {
+            // 304 Not Modified, the headers a 200 would carry minus the body
+            response_len = sprintf(response, "%.*s %d Not Modified\r\n%s%s%s\r\n", version_len, version, NOT_MODIFIED, validators, coding_header, end_headers(conn));
+            cache_count_not_modified(file_size);
+        }
+    }
+
+    static const int option_status[] = { OK, Partial_Content, RANGE_NOT_SATISFIABLE, NOT_MODIFIED };
+    conn->status = found ? option_status[option] : NOT_FOUND;
+    conn->response_len = response_len;
+}
+
+const char *overload_response(int *len)
+{
+    *len = overload_len;
+    return overload;
+}
+
+// the admin port only knows /metrics, rendered into the connection buffer
+// since the body has to stay around until it is sent
+void handle_admin_request(conn_t *conn)
+{
+    http_parser_t *parser = &conn->parser;
+    int version_len = parser->version.len;
+    const char *version = conn->request + parser->version.off;
+    conn->keep_alive = want_keep_alive(conn);
+
+    char url[256];
+    int len = normalize_url(conn->request + parser->url.off, parser->url.len, url, sizeof(url));
+    if (len < 0 || strcmp(url, "/metrics") != 0 || (conn->buf == NULL && (conn->buf = malloc(METRICS_BUF_SIZE)) == NULL)) {
+        conn->status = NOT_FOUND;
+        conn->response_len = sprintf(conn->response, "%.*s %d Not Found\r\nContent-Length: 0\r\n%s\r\n", version_len, version, NOT_FOUND, end_headers(conn));
+        return;
+    }
+
+    long long length = render_metrics(conn->buf, METRICS_BUF_SIZE);
+    if (!head_only(conn)) {
+        conn->body = conn->buf;
+        conn->body_len = length;
+    }
+    conn->status = OK;
+    conn->response_len = sprintf(conn->response, "%.*s %d OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %lld\r\n%s\r\n",
+            version_len, version, OK, length, end_headers(conn));
+}
+
+// normalize the path of a request url: drop the query, merge repeated slashes
+// and resolve "." and ".." so that the path cannot leave the docroot. Returns
+// the length of the result, or -1 if it is not an origin-form path or too long.
+int normalize_url(const char *url, int url_len, char *out, int size)
+{
+    const char *p = url;
+    const char *url_end = url + url_len;
+    int len = 0;
+
+    if (url_len == 0 || *p != '/')
+        return -1;
+
+    while (p < url_end && *p != '?' && *p != '#') {
+        while (p < url_end && *p == '/')
+            p++;
+        const char *segment = p;
+        while (p < url_end && *p != '/' && *p != '?' && *p != '#')
+            p++;
+        int segment_len = p - segment;
+
+        if (segment_len == 0 || (segment_len == 1 && segment[0] == '.'))
+            continue;
+        if (segment_len == 2 && segment[0] == '.' && segment[1] == '.') {
+            while (len > 0 && out[--len] != '/')
+                ;
+            continue;
+        }
+        if (len + 1 + segment_len >= size)
+            return -1;
+        out[len++] = '/';
+        memcpy(out + len, segment, segment_len);
+        len += segment_len;
+    }
+
+    if (len == 0)
+        out[len++] = '/';
+    out[len] = '\0';
+
+    return len;
+}
@@ -0,0 +1,45 @@
+#ifndef __ACCESSLOG_H__
+#define __ACCESSLOG_H__
+
+#include "metrics.h"
+
+#include <netinet/in.h>
+#include <time.h>
+
+#define LOG_RING_SIZE 4096              // records per worker, a power of two
+#define LOG_METHOD_SIZE 16
+#define LOG_URL_SIZE 200                // longer urls are cut off
+#define LOG_BUF_SIZE (256 << 10)        // batch handed to one write()
+#define LOG_FLUSH_MSEC 10               // how long the writer sleeps when idle
+
+// one request as the worker saw it, formatted by the log thread
+typedef struct log_record {
+    struct timespec time;               // when the response was done
+    struct sockaddr_in addr;
+    int status;
+    long long bytes;
+    long usec;
+    char method[LOG_METHOD_SIZE];
+    char url[LOG_URL_SIZE];
+} log_record_t;
+
+// single producer, single consumer: the worker appends at head, the log
+// thread consumes at tail, each index on a cache line of its own
+typedef struct log_ring {
+    unsigned long head __attribute__((aligned(CACHE_LINE)));
+    unsigned long tail_seen;            // last tail read by the worker
+    unsigned long dropped;              // records lost to a full ring
+    unsigned long tail __attribute__((aligned(CACHE_LINE)));
+    log_record_t records[LOG_RING_SIZE] __attribute__((aligned(CACHE_LINE)));
+} log_ring_t;
+
+log_ring_t *new_log_ring();
+
+// claim the next record, NULL if the ring is full and it was dropped
+log_record_t *log_reserve(log_ring_t *ring);
+void log_commit(log_ring_t *ring);
+
+void start_access_log(const char *path);
+void stop_access_log();
+
+#endif
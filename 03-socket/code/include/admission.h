@@ -0,0 +1,49 @@
+#ifndef __ADMISSION_H__
+#define __ADMISSION_H__
+
+#include "event.h"
+
+// Admission control: past capacity the server finishes the work it has taken
+// on and turns new connections away with a pre-rendered 503 and Retry-After,
+// rather than letting them pile up in the accept queue until clients time
+// out. A connection is shed when it is accepted while the accept queue of its
+// listener is longer than --shed-queue, while more than --max-conns are open,
+// while its event loop lags more than --shed-lag behind, or when its client
+// address already holds --max-conns-per-ip. Connections already admitted are
+// never shed, nor is the admin port, so /metrics stays reachable.
+//
+// A shed plaintext connection is answered right after accept(), it costs a
+// read, a write and a close. Over TLS a 503 would first cost the handshake,
+// the work the server is short of time for, so a shed TLS connection is reset
+// at accept instead and the client retries or goes elsewhere.
+//
+// A turn of a loop lags by how long it took from the wait returning to the
+// last event handled, events that became ready meanwhile waited that long. The
+// lag of the loop is a moving average over the last LAG_TURNS turns or so, a
+// single slow turn does not shed. A wait at least as long as the lag counts as
+// a turn without any, the loop has caught up then.
+
+// the per-client counts are kept in this many slots, addresses that hash to
+// the same slot share a cap
+#define ADMISSION_IP_SLOTS (1 << 16)
+
+// the newest turn weighs 1/LAG_TURNS in the lag
+#define LAG_TURNS 4
+// milliseconds of lag before new connections are shed
+#define DEFAULT_SHED_LAG 25
+// seconds a shed client is asked to wait before trying again
+#define DEFAULT_RETRY_AFTER 1
+
+// decide on a connection just accepted: 0 admits it and takes its place in
+// the per-client count. Returns -1 for a shed one, answered if it is plaintext
+// and set to be reset if it is TLS, the caller closes it.
+int admit_conn(event_loop_t *loop, listener_t *listener, int sock, const struct sockaddr_in *addr, int *client_slot);
+
+// a connection is closed, give back its place in the per-client count
+void release_admission(int client_slot);
+
+// bracket a turn of the event loop
+void start_turn(event_loop_t *loop);
+void end_turn(event_loop_t *loop);
+
+#endif
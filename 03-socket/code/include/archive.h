@@ -0,0 +1,89 @@
+#ifndef __ARCHIVE_H__
+#define __ARCHIVE_H__
+
+#include <stdint.h>
+
+// A docroot packed into one file by tools/mkarchive.c, served with --archive.
+// The server maps it once at startup and answers from the mapping, a request
+// costs a hash lookup and no filesystem syscalls. Edits to the docroot show up
+// once it is packed again and the server restarted.
+//
+// Layout, all offsets from the start of the file, in the byte order of the
+// machine that packed it:
+//
+//   archive_header_t
+//   uint32_t seeds[nbuckets]           displacement of each bucket
+//   uint32_t slots[nslots]             index into files, ARCHIVE_EMPTY if none
+//   archive_file_t files[nfiles]
+//   urls and rendered headers
+//   file data and gzip copies, each starting on a page
+//
+// The url index is a perfect hash (hash and displace): the seed of a url's
+// bucket sends every url to a slot of its own, so a lookup is two hashes and
+// one string compare, and a url that is not in the archive lands on an empty
+// slot or another url.
+
+#define ARCHIVE_MAGIC "HSARCHIV"
+#define ARCHIVE_VERSION 2
+#define ARCHIVE_ALIGN 4096
+#define ARCHIVE_EMPTY 0xffffffffu
+// room a file's rendered headers get, the server copies them into its response
+// buffer and adds the encoding and connection headers after them
+#define ARCHIVE_MAX_HEADER 256
+
+typedef struct archive_header {
+    char magic[8];
+    uint32_t version;                   // a byte swapped one does not match either
+    uint32_t nfiles;
+    uint32_t nbuckets;                  // powers of two
+    uint32_t nslots;
+    uint64_t seeds_off;
+    uint64_t slots_off;
+    uint64_t files_off;
+    uint64_t size;                      // of the whole archive
+} archive_header_t;
+
+// a packed file, the url is the normalized one requests are looked up by
+typedef struct archive_file {
+    uint64_t url_off;                   // NUL terminated
+    uint32_t url_len;
+    uint32_t header_len;                // Content-Length and validators of a 200,
+    uint64_t header_off;                // the status line is the request's
+    uint64_t data_off;
+    uint64_t size;
+    uint64_t gzip_off;                  // gzip copy, for compressible files
+    uint64_t gzip_size;                 // that shrink, 0 if there is none
+    uint32_t gzip_header_len;
+    uint32_t pad;
+    uint64_t gzip_header_off;
+    uint64_t ino;                       // of the packed file, the validators
+    int64_t mtime;                      // are the ones serving it from the
+    int64_t mtime_nsec;                 // docroot gives
+} archive_file_t;
+
+// 64-bit FNV-1a from a seeded basis, finished by the murmur3 mixer so that
+// nearby seeds give unrelated slots
+static inline uint64_t archive_hash(const char *url, int len, uint32_t seed)
+{
+    uint64_t hash = 14695981039346656037ull ^ (seed * 0x9e3779b97f4a7c15ull);
+    for (int i = 0; i < len; i++) {
+        hash ^= (unsigned char)url[i];
+        hash *= 1099511628211ull;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// map the archive, checking that everything in it stays inside it. Returns -1
+// with a message on stderr if it cannot be used.
+int open_archive(const char *path);
+// the file packed for a normalized url, NULL if there is none
+const archive_file_t *archive_lookup(const char *url, int len);
+// bytes of the archive at offset
+const char *archive_at(uint64_t off);
+
+#endif
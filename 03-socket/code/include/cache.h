@@ -0,0 +1,101 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "list.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define CACHE_BUCKETS 4096
+#define CACHE_HEADER_SIZE 128
+
+#define DEFAULT_CACHE_SIZE (64 << 20)
+#define DEFAULT_CACHE_MAX_ENTRY (1 << 20)
+#define DEFAULT_GZIP_CACHE_SIZE (16 << 20)
+
+#define GZIP_LEVEL 6
+#define GZIP_MIN_SIZE 256                // smaller files are not worth compressing
+
+// text formats worth compressing, everything else is sent as it is. The server
+// and mkarchive both go by this list.
+static inline int compressible(const char *url)
+{
+    static const char *types[] = {
+        ".html", ".htm", ".css", ".js", ".mjs", ".json", ".txt", ".xml", ".svg", ".csv", ".md", NULL
+    };
+
+    const char *ext = strrchr(url, '.');
+    if (ext == NULL || strchr(ext, '/'))
+        return 0;
+    for (int i = 0; types[i]; i++) {
+        if (strcasecmp(ext, types[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// a cached file, entries are reference counted so that a connection can keep
+// sending one after it has been evicted or invalidated
+typedef struct cache_entry {
+    struct list_head hash_list;         // chain of the hash bucket
+    struct list_head lru_list;          // most recently used at the head
+    char *url;                          // normalized url, the key
+    char *data;                         // the whole file
+    off_t size;
+    ino_t ino;                          // identify the version of the file for
+    time_t mtime;                       // validators
+    long mtime_nsec;
+    char *gzip;                         // gzip encoded copy, NULL until asked for
+    off_t gzip_size;
+    int gzip_useless;                   // compressing does not make it smaller
+    int no_sidecar;                     // bit per content coding without a sidecar file
+    char header[CACHE_HEADER_SIZE];     // pre-rendered headers of a 200 OK, the
+                                        // status line carries the request's
+                                        // version and is left out
+    int header_len;
+    int refs;
+    int linked;                         // still reachable from the table
+} cache_entry_t;
+
+typedef struct cache {
+    struct list_head hash_table[CACHE_BUCKETS];
+    struct list_head lru;
+    pthread_mutex_t lock;
+    long capacity;                      // bytes of file data kept at most
+    long max_entry;                     // larger files are never cached
+    unsigned long generation;           // bumped on every invalidation
+
+    long resident;                      // bytes of file data held by entries
+    unsigned long entries;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long invalidations;
+
+    long gzip_capacity;                 // bytes of gzip copies kept at most
+    long gzip_resident;
+    unsigned long gzip_copies;
+    unsigned long compressions;
+    unsigned long compressed_in;        // bytes fed to and produced by the compressor
+    unsigned long compressed_out;
+    unsigned long compress_usec;        // cpu time spent compressing
+    unsigned long encoded_responses;    // sent with a content coding
+    unsigned long encoded_saved;        // bytes those saved over identity
+    unsigned long not_modified;         // 304 responses
+    unsigned long not_modified_saved;   // body bytes they did not send
+} cache_t;
+
+int init_cache(long capacity, long max_entry, long gzip_capacity, const char *docroot);
+cache_entry_t *cache_lookup(const char *url, unsigned long *generation);
+cache_entry_t *cache_load(const char *url, int fd, const struct stat *st, unsigned long generation);
+void cache_release(cache_entry_t *entry);
+int cache_gzip(cache_entry_t *entry);
+void cache_count_encoded(off_t identity_size, off_t encoded_size);
+void cache_count_not_modified(off_t size);
+void cache_invalidate(const char *url, int prefix);
+void dump_cache_stats();
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+// how the workers wait for and issue socket I/O
+enum engine {
+    ENGINE_EPOLL,                       // readiness with epoll, non-blocking syscalls
+    ENGINE_URING,                       // completions with io_uring
+};
+
+typedef struct server_config {
+    int workers;                        // worker threads, one event loop each
+    int handshake_threads;              // threads running TLS handshakes, 0 leaves them to the workers
+    int pin_cpus;                       // pin worker i to the i-th usable cpu
+    int engine;                         // ENGINE_EPOLL or ENGINE_URING
+    int plain_port;                     // plaintext port serving files, 0 if none
+    int admin_port;                     // port serving /metrics, 0 if none
+    const char *canonical_host;         // host redirects point to, NULL for the Host header
+    int hsts_max_age;                   // Strict-Transport-Security max-age on https, 0 sends none
+    int backlog;                        // pending connections per listener
+    int low_latency;                    // TCP Fast Open and deferred accept on the listeners
+    int http2;                          // offer h2 in the TLS handshake
+    const char *access_log;             // access log file, "-" for stdout, NULL if none
+    int use_sendfile;                   // send file bodies with sendfile()
+    int use_ktls;                       // offload TLS record encryption to the kernel
+    int buffer_size;                    // per-connection body buffer in bytes
+    int session_cache_size;             // TLS sessions kept for resumption, 0 disables
+    int ticket_rotate;                  // seconds between ticket keys, 0 disables tickets
+    const char *archive;                // docroot archive served instead of files, NULL if none
+    long cache_size;                    // bytes of files cached in memory, 0 disables
+    long cache_max_entry;               // larger files are never cached
+    long gzip_cache_size;               // bytes of gzip copies of cached files, 0 disables
+    int keepalive_timeout;              // seconds an idle connection is kept, 0 disables
+    int keepalive_requests;             // requests served on one connection at most
+    int handshake_timeout;              // seconds to finish the TLS handshake
+    int header_timeout;                 // seconds to send a request's header block
+    int send_timeout;                   // seconds the client may stall a response or upload
+    long max_upload;                    // largest PUT or POST body stored, 0 disables uploads
+    int max_conns;                      // open connections past which new ones are shed, 0 for no limit
+    int max_conns_per_ip;               // connections one client address may hold, 0 for no limit
+    int shed_queue;                     // accept queue length at which new connections are shed, 0 never
+    int shed_lag;                       // milliseconds of event loop lag at which new connections are shed, 0 never
+    int retry_after;                    // seconds a shed client is asked to wait
+    int verbose;                        // log per-connection details to stderr
+} server_config_t;
+
+extern server_config_t config;
+
+void parse_args(int argc, char **argv);
+
+#endif
@@ -0,0 +1,212 @@
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include "accesslog.h"
+#include "list.h"
+#include "metrics.h"
+#include "parser.h"
+#include "timer.h"
+
+#include <netinet/in.h>
+#include <openssl/ssl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#define MAX_EVENTS 256
+#define LISTEN_BACKLOG 1024
+
+#define REQUEST_BUF_SIZE 4096
+#define RESPONSE_BUF_SIZE 1024
+
+// upper bound of a single sendfile() or in-memory body write, so a huge body
+// is pushed out in pieces
+#define BODY_CHUNK (1 << 20)
+
+// a response whose headers and in-memory body fit one full TLS record is
+// encrypted as a single record
+#define TLS_RECORD_SIZE 16384
+
+// parts of a multipart/byteranges response at most, a request asking for more
+// gets the whole file
+#define MAX_RANGES 16
+
+// bounds and default of the per-connection body buffer used when the body has
+// to pass through user space
+#define MIN_BODY_BUF_SIZE (4 << 10)
+#define MAX_BODY_BUF_SIZE (16 << 20)
+#define DEFAULT_BODY_BUF_SIZE (128 << 10)
+
+#define DEFAULT_KEEPALIVE_TIMEOUT 5
+#define DEFAULT_KEEPALIVE_REQUESTS 100
+
+// seconds a client gets to finish the TLS handshake, to send the whole header
+// block of a request, and to take each piece of the response
+#define DEFAULT_HANDSHAKE_TIMEOUT 10
+#define DEFAULT_HEADER_TIMEOUT 10
+#define DEFAULT_SEND_TIMEOUT 30
+
+// counters are written only by the owning worker and read by whoever dumps
+// them, a relaxed store keeps the reader from seeing torn values
+#define stat_add(x, n) __atomic_store_n(&(x), (x) + (n), __ATOMIC_RELAXED)
+
+enum ev_type { EV_LISTENER, EV_CONN, EV_HANDOFF };
+
+// what a listener does with the requests it receives
+enum listen_role {
+    SERVE_REDIRECT,                     // answer 301 to the https site
+    SERVE_TLS,                          // serve files over TLS
+    SERVE_PLAIN,                        // serve files in plaintext
+    SERVE_ADMIN,                        // serve /metrics
+};
+
+// a connection walks through these states in order, the handshake state is
+// only used on the https port, which hands connections that negotiated h2 to
+// the HTTP/2 state for good, and the body state only by uploads
+enum conn_state {
+    CONN_HANDSHAKE,
+    CONN_READ_REQUEST,
+    CONN_READ_BODY,
+    CONN_WRITE_HEADER,
+    CONN_WRITE_BODY,
+    CONN_H2,
+    CONN_CLOSE,
+};
+
+// an inclusive byte range of the file
+typedef struct byte_range {
+    off_t start;
+    off_t end;
+} byte_range_t;
+
+typedef struct listener {
+    int type;                           // EV_LISTENER
+    int fd;
+    int port;
+    int role;
+    int queued;                         // connections waiting behind the last accept
+    unsigned long queue_turn;           // turn of the loop it was sampled in
+    int completed;                      // accepts the ring completed this turn
+} listener_t;
+
+typedef struct conn {
+    int type;                           // EV_CONN
+    int fd;
+    int role;                           // role of the listener it came from
+    struct sockaddr_in addr;            // client address
+    SSL *ssl;                           // NULL on plaintext connections
+    int ktls;                           // kernel TLS send offload is active
+    long accept_usec;                   // when the handshake started
+    int state;
+    struct h2_session *h2;              // streams of an HTTP/2 connection, NULL for HTTP/1.1
+    struct upload *upload;              // body of a PUT or POST being stored, NULL if none
+    struct conn *handoff_next;          // on a worker's handoff stack
+    int client_slot;                    // 1 + slot of its client address, 0 if not counted
+
+    char request[REQUEST_BUF_SIZE + 1];
+    int request_len;
+    int request_end;                    // end of the request being answered,
+                                        // pipelined requests follow it
+    http_parser_t parser;               // state of the request being received
+    int requests;                       // requests received on this connection
+    int keep_alive;                     // wait for another request afterwards
+    long request_usec;                  // when the request was parsed
+    int status;                         // status code of the response
+    long long sent;                     // bytes of the response sent so far
+
+    wheel_timer_t timer;                // deadline of the current state
+    int idle;                           // waiting for the next request
+
+    char response[RESPONSE_BUF_SIZE];   // status line and headers
+    int response_len;
+    int response_sent;
+
+    int file_fd;                        // file the body is taken from, -1 if none
+    off_t file_offset;                  // next byte of the file to send or read
+    off_t file_left;                    // bytes not yet sent or read into buf
+    off_t file_size;                    // size of the whole file
+    int zero_copy;                      // body goes out with (SSL_)sendfile()
+
+    char *buf;                          // body chunk read from the file
+    int buf_len;
+    int buf_sent;
+
+    struct cache_entry *cache_entry;    // cached file the body points into
+    const char *cache_data;             // its data or its gzip copy
+    const char *body;                   // in-memory body, NULL if none
+    off_t body_len;
+    off_t body_sent;
+
+    byte_range_t ranges[MAX_RANGES];    // parts of a multipart/byteranges body
+    int nranges;                        // 0 unless the body is multipart
+    int next_range;                     // next part to send, nranges stands for
+                                        // the closing delimiter
+    char boundary[24];                  // separates the parts
+
+    // io_uring engine only
+    int inflight;                       // ring requests not yet completed
+    int closing;                        // freed once inflight drops to 0
+    int fixed_buf;                      // registered buffer of the body, -1 if none
+    int fixed_file;                     // registered file slot of file_fd, -1 if none
+    struct iovec iov[2];                // header and in-memory body of a send
+    struct msghdr msg;
+} conn_t;
+
+struct uring;
+
+// connections the handshake pool has finished, pushed by any handshake
+// thread and taken all at once by the worker: a lock-free stack, newest
+// first, and an eventfd that is written when a push finds it empty
+typedef struct handoff {
+    int type;                           // EV_HANDOFF
+    int fd;
+    conn_t *head;
+    long depth;                         // pushed and not yet taken
+    unsigned long long count;           // eventfd counter read by the ring
+} handoff_t;
+
+typedef struct event_loop {
+    int epfd;
+    struct uring *ring;                 // io_uring engine, NULL when using epoll
+    listener_t listeners[4];
+    int nlisteners;
+    timer_wheel_t timers;               // deadlines of the connections
+    int nconns;                         // number of open connections
+    unsigned long accepted;             // connections accepted so far
+    unsigned long ktls_conns;           // TLS connections sending through kTLS
+    unsigned long user_tls_conns;       // TLS connections encrypting in user space
+    unsigned long full_handshakes;
+    unsigned long resumed_handshakes;
+    unsigned long full_handshake_usec;  // total time spent in full handshakes
+    unsigned long resumed_handshake_usec;
+    unsigned long turns;                // wakeups of the loop, see admission.h
+    long turn_usec;                     // start of the current turn, or end of the last
+    long lag_usec;                      // how long ready events wait to be handled, averaged
+    log_ring_t *log;                    // access log records, NULL if not logging
+    int handshake_only;                 // a handshake thread, it hands connections off
+    handoff_t handoff;                  // connections handed to this worker
+    metrics_t metrics;                  // on cache lines of its own
+} event_loop_t;
+
+void init_event_loop(event_loop_t *loop);
+void init_handshake_loop(event_loop_t *loop);
+void run_event_loop(event_loop_t *loop);
+
+// shared with the io_uring engine
+conn_t *new_conn(event_loop_t *loop, listener_t *listener, int csock, struct sockaddr_in *addr);
+void close_conn(event_loop_t *loop, conn_t *conn);
+void process_conn(event_loop_t *loop, conn_t *conn);
+int prepare_response(event_loop_t *loop, conn_t *conn);
+void finish_response(event_loop_t *loop, conn_t *conn);
+void count_request(event_loop_t *loop, conn_t *conn);
+void stop_idle(event_loop_t *loop, conn_t *conn);
+void conn_sent(event_loop_t *loop, conn_t *conn, long n);
+void conn_received(event_loop_t *loop, conn_t *conn, long n);
+int conn_read(conn_t *conn, char *buf, int len);
+int conn_peek(conn_t *conn, char *buf, int len);
+int conn_write(conn_t *conn, const char *buf, int len);
+void expire_conns(event_loop_t *loop);
+conn_t *take_handoffs(event_loop_t *loop);
+void adopt_conn(event_loop_t *loop, conn_t *conn);
+
+#endif
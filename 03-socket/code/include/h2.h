@@ -0,0 +1,128 @@
+#ifndef __H2_H__
+#define __H2_H__
+
+#include "event.h"
+#include "hpack.h"
+#include "list.h"
+
+// HTTP/2 (RFC 9113) over TLS, picked by ALPN. Every stream is answered by the
+// HTTP/1.1 handlers: its header block is turned back into a request, handled
+// on a connection of its own that never touches the socket, and the response
+// is framed from there, so 200, 206, 304, 404 and friends come out the same.
+// The DATA of an upload is stored as it comes and answered at its end.
+
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN 24
+
+#define H2_FRAME_HEADER 9
+// largest frame payload either side sends, the default of the protocol
+#define H2_MAX_FRAME 16384
+// streams a client may have open at a time
+#define H2_MAX_STREAMS 100
+// flow control window every stream and the connection start with
+#define H2_WINDOW 65535
+#define H2_MAX_WINDOW 0x7fffffffL
+// window the client gets for sending request bodies, per stream and in all
+#define H2_RECV_WINDOW (1 << 20)
+// longest header block accepted, CONTINUATION frames included
+#define H2_MAX_HEADER_BLOCK (16 << 10)
+// frames are queued here and leave in as few writes as possible
+#define H2_OUT_SIZE (64 << 10)
+// room kept free in the output for control frames, so reading can go on
+// while the response frames fill it
+#define H2_OUT_RESERVE 64
+
+enum h2_frame_type {
+    H2_DATA,
+    H2_HEADERS,
+    H2_PRIORITY,
+    H2_RST_STREAM,
+    H2_SETTINGS,
+    H2_PUSH_PROMISE,
+    H2_PING,
+    H2_GOAWAY,
+    H2_WINDOW_UPDATE,
+    H2_CONTINUATION,
+};
+
+#define H2_FLAG_END_STREAM 0x1
+#define H2_FLAG_ACK 0x1
+#define H2_FLAG_END_HEADERS 0x4
+#define H2_FLAG_PADDED 0x8
+#define H2_FLAG_PRIORITY 0x20
+
+enum h2_setting {
+    H2_SETTINGS_HEADER_TABLE_SIZE = 1,
+    H2_SETTINGS_ENABLE_PUSH,
+    H2_SETTINGS_MAX_CONCURRENT_STREAMS,
+    H2_SETTINGS_INITIAL_WINDOW_SIZE,
+    H2_SETTINGS_MAX_FRAME_SIZE,
+    H2_SETTINGS_MAX_HEADER_LIST_SIZE,
+};
+
+enum h2_error {
+    H2_NO_ERROR,
+    H2_PROTOCOL_ERROR,
+    H2_INTERNAL_ERROR,
+    H2_FLOW_CONTROL_ERROR,
+    H2_SETTINGS_TIMEOUT,
+    H2_STREAM_CLOSED,
+    H2_FRAME_SIZE_ERROR,
+    H2_REFUSED_STREAM,
+    H2_CANCEL,
+    H2_COMPRESSION_ERROR,
+    H2_CONNECT_ERROR,
+    H2_ENHANCE_YOUR_CALM,
+};
+
+typedef struct h2_stream {
+    struct list_head list;              // in the session's round-robin order
+    unsigned id;
+    long window;                        // bytes the peer lets us send
+    int headers_sent;
+    int head_only;                      // HEAD, the body is left out
+    int remote_open;                    // the client is still sending the request
+    long unacked;                       // DATA taken since its last WINDOW_UPDATE
+    conn_t req;                         // request and response of the stream
+} h2_stream_t;
+
+typedef struct h2_session {
+    conn_t *conn;                       // the TLS connection carrying it
+    int preface;                        // bytes of the client preface seen
+
+    unsigned char in[H2_FRAME_HEADER + H2_MAX_FRAME];
+    int in_len;
+
+    // a header block split over CONTINUATION frames
+    unsigned char block[H2_MAX_HEADER_BLOCK];
+    int block_len;
+    unsigned block_stream;              // 0 unless a block is incomplete
+    int block_end_stream;               // the block's HEADERS ended the stream
+
+    unsigned char out[H2_OUT_SIZE];
+    int out_len;
+    int out_sent;
+
+    hpack_table_t decoder;
+
+    struct list_head streams;
+    int nstreams;
+    unsigned last_stream;               // highest stream the client opened
+
+    long window;                        // connection window we may send into
+    long unacked;                       // DATA taken since the last WINDOW_UPDATE
+    long initial_window;                // the peer's window of new streams
+    int goaway;                         // no new streams, close once drained
+} h2_session_t;
+
+h2_session_t *new_h2_session(conn_t *conn);
+void free_h2_session(h2_session_t *h2);
+
+// read, answer and write until the socket would block, returns -1 once the
+// connection has to be closed
+int h2_process(event_loop_t *loop, conn_t *conn);
+
+// a stream, frame or write is in progress, the connection is not idle
+int h2_busy(h2_session_t *h2);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef __HPACK_H__
+#define __HPACK_H__
+
+// HPACK (RFC 7541) header compression of HTTP/2. Requests are decoded in
+// full, Huffman coding and the dynamic table included. Responses are encoded
+// without either, as literals that point into the static table where it has
+// the name, which keeps the encoder stateless.
+
+#define HPACK_STATIC_ENTRIES 61
+
+// header table size both ends start with, the decoder never allows more
+#define HPACK_TABLE_SIZE 4096
+
+// every entry costs its name and value plus this much of the table size
+#define HPACK_ENTRY_OVERHEAD 32
+#define HPACK_MAX_ENTRIES (HPACK_TABLE_SIZE / HPACK_ENTRY_OVERHEAD)
+
+// longest name or value the decoder hands out
+#define HPACK_STRING_MAX 4096
+
+// the dynamic table of a decoder, entries lie back to back in data with the
+// oldest first, so eviction shifts the rest down and lookups stay contiguous
+typedef struct hpack_table {
+    char data[HPACK_TABLE_SIZE];
+    int used;                           // bytes of data in use
+    struct {
+        short off;
+        short name_len;
+        short value_len;
+    } entries[HPACK_MAX_ENTRIES];
+    int count;
+    int size;                           // table size as RFC 7541 counts it
+    int max_size;                       // limit set by the encoder
+} hpack_table_t;
+
+// called for every decoded header in order, the strings only live until it
+// returns
+typedef void (*hpack_emit_t)(void *arg, const char *name, int name_len, const char *value, int value_len);
+
+void init_hpack_table(hpack_table_t *table);
+
+// decode a complete header block, returns 0, or -1 on a compression error
+// after which the table is out of step with the peer's
+int hpack_decode(hpack_table_t *table, const unsigned char *in, int len, hpack_emit_t emit, void *arg);
+
+// append a header to out, returns the bytes written or -1 if size is too small
+int hpack_encode_status(unsigned char *out, int size, int status);
+int hpack_encode_header(unsigned char *out, int size, const char *name, int name_len, const char *value, int value_len);
+
+#endif
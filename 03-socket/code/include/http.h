@@ -0,0 +1,54 @@
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include "event.h"
+
+#define HTTP_PORT 80
+#define HTTPS_PORT 443
+
+#define CONTINUE 100
+#define OK 200
+#define CREATED 201
+#define NO_CONTENT 204
+#define NOT_FOUND 404
+#define Partial_Content 206
+#define Moved_Permanently 301
+#define NOT_MODIFIED 304
+#define BAD_REQUEST 400
+#define FORBIDDEN 403
+#define CONFLICT 409
+#define PAYLOAD_TOO_LARGE 413
+#define URI_TOO_LONG 414
+#define RANGE_NOT_SATISFIABLE 416
+#define HEADERS_TOO_LARGE 431
+#define INTERNAL_SERVER_ERROR 500
+#define NOT_IMPLEMENTED 501
+#define SERVICE_UNAVAILABLE 503
+
+// longest url a redirect is sent for
+#define MAX_REDIRECT_URL 512
+// longest host name a redirect points to
+#define MAX_HOST_LEN 255
+// where a redirect points without --canonical-host when an HTTP/1.0 client
+// sent no Host header to go by
+#define DEFAULT_REDIRECT_HOST "10.0.0.1"
+
+// range-specs looked at in one Range header, more and the header is ignored
+#define MAX_RANGE_SPECS 64
+// ranges closer than this are sent as one part, a part header costs about as much
+#define RANGE_COALESCE_GAP 80
+
+void init_end_headers(void);
+void handle_file_request(conn_t *conn);
+void handle_http_request(conn_t *conn);
+void handle_admin_request(conn_t *conn);
+void handle_bad_request(conn_t *conn, int status);
+// the 503 of admission control, rendered at startup
+const char *overload_response(int *len);
+void handle_upload_request(conn_t *conn, int framed);
+void handle_upload_done(conn_t *conn, int status);
+int next_range_part(conn_t *conn);
+int parse_ranges(const char *value, int len, off_t size, byte_range_t *ranges);
+int normalize_url(const char *url, int url_len, char *out, int size);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#define CACHE_LINE 64
+
+// request latency buckets: bucket i holds requests that took less than 2^i
+// microseconds, the last one everything slower (about 4s and up)
+#define LATENCY_BUCKETS 23
+
+// room for the rendered /metrics page
+#define METRICS_BUF_SIZE (16 << 10)
+
+// status codes counted one by one, anything else is counted as other
+enum metric_status {
+    STATUS_200,
+    STATUS_201,
+    STATUS_204,
+    STATUS_206,
+    STATUS_301,
+    STATUS_304,
+    STATUS_400,
+    STATUS_404,
+    STATUS_413,
+    STATUS_414,
+    STATUS_416,
+    STATUS_431,
+    STATUS_503,
+    STATUS_OTHER,
+    NSTATUS,
+};
+
+// why admission control turned work away
+enum shed_reason {
+    SHED_QUEUE,                         // the accept queue was too long
+    SHED_CONNS,                         // too many connections were open
+    SHED_CLIENT,                        // its client had too many of them
+    SHED_LAG,                           // the event loop was behind
+    NSHED,
+};
+
+// per-worker counters, only the owning worker writes them and only with
+// stat_add(), the alignment keeps them off the cache lines of other workers
+// so recording never bounces a line, /metrics sums them up when scraped
+typedef struct metrics {
+    unsigned long responses[NSTATUS];   // by status code
+    unsigned long bytes_sent;           // headers and bodies
+    unsigned long bytes_received;       // request bodies of uploads
+    unsigned long latency[LATENCY_BUCKETS];
+    unsigned long latency_usec;         // sum of all latencies
+    unsigned long timeouts;             // connections closed for missing a
+                                        // deadline, idle keep-alive ones aside
+    unsigned long shed[NSHED];          // by admission control, by reason
+} __attribute__((aligned(CACHE_LINE))) metrics_t;
+
+void count_response(metrics_t *metrics, int status, long usec);
+
+// render the Prometheus text format, returns its length
+int render_metrics(char *buf, int size);
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef __PARSER_H__
+#define __PARSER_H__
+
+#define MAX_HEADERS 32
+// length of the only versions accepted, HTTP/1.0 to HTTP/1.9
+#define HTTP_VERSION_LEN 8
+
+// a piece of the request buffer, offsets stay valid when the buffer moves
+typedef struct str_view {
+    int off;
+    int len;
+} str_view_t;
+
+typedef struct http_header {
+    str_view_t name;
+    str_view_t value;
+} http_header_t;
+
+enum parse_result {
+    PARSE_AGAIN = 0,                    // need more bytes
+    PARSE_OK = 1,                       // the header block is complete
+    PARSE_ERROR = -1,                   // malformed request
+    PARSE_TOO_LARGE = -2,               // too many headers
+};
+
+enum parse_state {
+    PARSE_METHOD,
+    PARSE_URL,
+    PARSE_VERSION,
+    PARSE_LINE_LF,                      // LF ending the request line or a header
+    PARSE_HEADER_START,
+    PARSE_HEADER_NAME,
+    PARSE_VALUE_START,
+    PARSE_VALUE,
+    PARSE_SKIP_LINE,                    // a header line nobody asked for
+    PARSE_END_LF,                       // LF of the blank line
+    PARSE_DONE,
+};
+
+// an incremental request parser, it keeps its place between calls so a
+// request split over several reads is scanned only once, and records views
+// into the buffer instead of copying anything
+typedef struct http_parser {
+    int state;
+    int pos;                            // next byte to scan
+    int mark;                           // start of the token being scanned
+    str_view_t method;
+    str_view_t url;
+    str_view_t version;
+    str_view_t name;                    // name of the header being scanned
+    http_header_t headers[MAX_HEADERS];
+    int nheaders;
+    int end;                            // bytes taken by the request head
+} http_parser_t;
+
+void init_parser(http_parser_t *parser);
+int parse_request(http_parser_t *parser, const char *buf, int len);
+int parse_request_line(http_parser_t *parser, const char *buf, int len);
+
+int view_equals(const char *buf, str_view_t view, const char *str);
+int view_case_equals(const char *buf, str_view_t view, const char *str);
+int view_has_token(const char *buf, str_view_t view, const char *token);
+int view_accepts(const char *buf, str_view_t view, const char *coding);
+const http_header_t *find_header(const http_parser_t *parser, const char *buf, const char *name);
+
+#endif
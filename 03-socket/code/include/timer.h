@@ -0,0 +1,34 @@
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include "list.h"
+
+// a hashed timer wheel with one second ticks: a timer hangs off the slot of
+// its expiry tick, so arming and cancelling are O(1) and a tick only looks at
+// the timers of its own slot. Deadlines further out than the wheel stay in
+// their slot until the wheel comes around to their tick.
+#define WHEEL_SLOTS 64                  // a power of two
+
+typedef struct wheel_timer {
+    struct list_head list;              // slot of the expiry tick
+    long expires;                       // tick it fires at
+    int armed;
+} wheel_timer_t;
+
+typedef struct timer_wheel {
+    struct list_head slots[WHEEL_SLOTS];
+    long tick;                          // next tick to run
+    int armed;                          // timers in the wheel
+} timer_wheel_t;
+
+void init_wheel(timer_wheel_t *wheel, long now);
+
+// (re)arm the timer to fire at tick expires
+void arm_timer(timer_wheel_t *wheel, wheel_timer_t *timer, long expires);
+void cancel_timer(timer_wheel_t *wheel, wheel_timer_t *timer);
+
+// run the ticks up to now, fire() gets every timer that expired, already
+// disarmed so it may free it
+void expire_timers(timer_wheel_t *wheel, long now, void (*fire)(wheel_timer_t *, void *), void *arg);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __TLS_H__
+#define __TLS_H__
+
+#include <openssl/ssl.h>
+#include <time.h>
+
+#define DEFAULT_SESSION_CACHE_SIZE 20480
+#define DEFAULT_TICKET_ROTATE 3600
+#define DEFAULT_HANDSHAKE_THREADS 0
+
+// session tickets stay decryptable for this many key lifetimes
+#define TICKET_KEYS 3
+
+typedef struct ticket_key {
+    unsigned char name[16];
+    unsigned char aes_key[32];
+    unsigned char hmac_key[32];
+    time_t created;
+} ticket_key_t;
+
+extern SSL_CTX *ssl_ctx;
+
+void init_ssl_ctx();
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef __UPLOAD_H__
+#define __UPLOAD_H__
+
+#include "event.h"
+
+#include <string.h>
+#include <sys/types.h>
+
+// PUT and POST store the request body at the path of the url. The body goes
+// to a hidden file next to it that is renamed over the path once complete, so
+// readers see the old file or the new one and never a part of it. In
+// plaintext the body is spliced from the socket into the file through a pipe
+// and never enters user space, over TLS it is decrypted into the connection's
+// body buffer and written from there.
+
+// the hidden file of an upload is ".<name>.<n>.part" next to its path
+#define UPLOAD_PART_SUFFIX ".part"
+
+// whether the last component of a path names the hidden file of an upload.
+// Those are neither served while written nor packed by mkarchive if a crash
+// leaves them behind.
+static inline int is_upload_part(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    size_t len = strlen(name), suffix_len = strlen(UPLOAD_PART_SUFFIX);
+    return name[0] == '.' && len > suffix_len && strcmp(name + len - suffix_len, UPLOAD_PART_SUFFIX) == 0;
+}
+
+// capacity asked for the pipe, every splice() moves up to this much
+#define UPLOAD_PIPE_SIZE (1 << 20)
+// framing bytes looked at in one go: a chunk size line and the CRLFs around it
+#define UPLOAD_PEEK_SIZE 64
+// longest chunk size line, extensions included, and longest trailer section
+#define UPLOAD_MAX_LINE 4096
+
+// where the body stands, a Content-Length body is one piece of data
+enum body_state {
+    BODY_DATA,                          // left bytes of data follow
+    CHUNK_SIZE,                         // hex digits of a chunk size
+    CHUNK_EXT,                          // extensions, skipped up to the LF
+    CHUNK_DATA_CR,                      // CRLF ending the data of a chunk
+    CHUNK_DATA_LF,
+    TRAILER_START,                      // a trailer line, or the blank line
+    TRAILER_LINE,                       // a trailer, nobody looks at it
+    BODY_DONE,
+};
+
+typedef struct upload {
+    int fd;                             // the hidden file
+    int pipe[2];                        // socket to file, -1 until the first splice
+    int pipe_size;
+    int state;
+    int chunked;                        // Transfer-Encoding: chunked
+    off_t left;                         // bytes of data before the next framing
+    off_t size;                         // bytes of data stored
+    off_t chunk;                        // size of the chunk being announced
+    int digits;                         // hex digits of it so far
+    int line;                           // framing bytes of the line or trailers
+    int created;                        // there was no file at the path before
+    int status;                         // set once the upload failed
+    char url[256];
+    char path[260];                     // where the file ends up
+    char tmp[300];                      // where it is written, "" once renamed
+} upload_t;
+
+// PUT and POST store their body when uploads are enabled
+int wants_upload(conn_t *conn);
+
+// create the hidden file for a body of length bytes, -1 if HTTP/2 frames it
+// without a Content-Length, or of chunks, to be stored at url. Returns 0, or
+// the status code of the failure.
+int start_upload(conn_t *conn, const char *url, int chunked, off_t length);
+
+// receive the body until the socket would block, returns 1 once the final
+// response is ready, 0 if more has to be read, -1 if the connection has to
+// be closed
+int read_upload(event_loop_t *loop, conn_t *conn);
+
+// store data of a body the transport frames, the DATA frames of an HTTP/2
+// stream. Returns 0, or -1 once the upload has failed.
+int upload_data(upload_t *up, const char *buf, int len);
+
+// the body is complete or the upload failed: move the file into place and
+// prepare the final response
+void finish_upload(conn_t *conn);
+
+void free_upload(upload_t *up);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include "event.h"
+
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 4096              // submission queue entries
+#define URING_RECV_BUFS 256             // provided receive buffers, a power of 2
+#define URING_RECV_BUF_SIZE REQUEST_BUF_SIZE
+#define URING_RECV_GROUP 0
+#define URING_FIXED_BUFS 64             // registered body buffers
+#define URING_FILES 1024                // registered file slots
+
+// a worker's ring and the resources registered with it, everything is used
+// by the owning worker only
+typedef struct uring {
+    int fd;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned tail;                      // next sqe to fill
+    unsigned submitted;                 // sqes handed to the kernel so far
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    struct io_uring_buf_ring *recv_ring;
+    char *recv_bufs;
+    unsigned short recv_tail;
+
+    char *fixed_bufs;                   // URING_FIXED_BUFS body buffers
+    int free_bufs[URING_FIXED_BUFS];    // free lists, used as stacks
+    int nfree_bufs;
+    int free_files[URING_FILES];
+    int nfree_files;
+
+    unsigned long enters;               // io_uring_enter() calls
+    unsigned long completions;
+} uring_t;
+
+int init_uring(event_loop_t *loop);
+void run_uring_loop(event_loop_t *loop);
+void cancel_conn_io(event_loop_t *loop, conn_t *conn);
+void release_conn_io(event_loop_t *loop, conn_t *conn);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __WORKER_H__
+#define __WORKER_H__
+
+#include "event.h"
+
+#include <pthread.h>
+
+typedef struct worker {
+    int id;
+    int cpu;                            // pinned cpu, -1 if not pinned
+    pthread_t thread;
+    event_loop_t loop;
+} worker_t;
+
+extern worker_t *workers;
+extern int nworkers;
+extern worker_t *handshakers;           // the TLS handshake pool, if any
+extern int nhandshakers;
+
+void start_workers(int n, int pin_cpus);
+void start_handshake_pool(int n);
+void hand_off(event_loop_t *loop, conn_t *conn);
+void dump_worker_stats();
+
+#endif
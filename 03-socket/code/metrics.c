@@ -0,0 +1,154 @@
+#include "event.h"
+#include "metrics.h"
+#include "worker.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+static const int status_codes[NSTATUS] = { 200, 201, 204, 206, 301, 304, 400, 404, 413, 414, 416, 431, 503, 0 };
+
+static const char *shed_reasons[NSHED] = { "queue", "conns", "client", "lag" };
+
+static int status_index(int status)
+{
+    switch (status) {
+        case 200: return STATUS_200;
+        case 201: return STATUS_201;
+        case 204: return STATUS_204;
+        case 206: return STATUS_206;
+        case 301: return STATUS_301;
+        case 304: return STATUS_304;
+        case 400: return STATUS_400;
+        case 404: return STATUS_404;
+        case 413: return STATUS_413;
+        case 414: return STATUS_414;
+        case 416: return STATUS_416;
+        case 431: return STATUS_431;
+        case 503: return STATUS_503;
+        default: return STATUS_OTHER;
+    }
+}
+
+void count_response(metrics_t *metrics, int status, long usec)
+{
+    int bucket = usec > 0 ? 64 - __builtin_clzl(usec) : 0;
+    if (bucket >= LATENCY_BUCKETS)
+        bucket = LATENCY_BUCKETS - 1;
+
+    stat_add(metrics->responses[status_index(status)], 1);
+    stat_add(metrics->latency[bucket], 1);
+    stat_add(metrics->latency_usec, usec);
+}
+
+#define load(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+
+// append to the page, the output is cut off if it does not fit
+static void append(char *buf, int size, int *len, const char *fmt, ...)
+{
+    if (*len >= size)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    *len += vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+}
+
+int render_metrics(char *buf, int size)
+{
+    metrics_t sum = {0};
+    unsigned long accepted = 0, full = 0, resumed = 0, log_dropped = 0;
+    long active = 0, handshaking = 0, handed_off = 0, lag = 0;
+    int len = 0;
+
+    // the handshake threads accept, time out and count handshakes too
+    for (int i = 0; i < nworkers + nhandshakers; i++) {
+        event_loop_t *loop = i < nworkers ? &workers[i].loop : &handshakers[i - nworkers].loop;
+        metrics_t *m = &loop->metrics;
+        for (int s = 0; s < NSTATUS; s++)
+            sum.responses[s] += load(m->responses[s]);
+        for (int b = 0; b < LATENCY_BUCKETS; b++)
+            sum.latency[b] += load(m->latency[b]);
+        sum.bytes_sent += load(m->bytes_sent);
+        sum.bytes_received += load(m->bytes_received);
+        sum.latency_usec += load(m->latency_usec);
+        sum.timeouts += load(m->timeouts);
+        for (int r = 0; r < NSHED; r++)
+            sum.shed[r] += load(m->shed[r]);
+        if (!loop->handshake_only && load(loop->lag_usec) > lag)
+            lag = load(loop->lag_usec);
+        accepted += load(loop->accepted);
+        active += load(loop->nconns);
+        full += load(loop->full_handshakes);
+        resumed += load(loop->resumed_handshakes);
+        if (loop->log)
+            log_dropped += load(loop->log->dropped);
+        if (loop->handshake_only)
+            handshaking += load(loop->nconns);
+        else
+            handed_off += load(loop->handoff.depth);
+    }
+
+    append(buf, size, &len, "# HELP http_responses_total Responses sent, by status code.\n"
+            "# TYPE http_responses_total counter\n");
+    for (int s = 0; s < NSTATUS; s++) {
+        if (s == STATUS_OTHER)
+            append(buf, size, &len, "http_responses_total{code=\"other\"} %lu\n", sum.responses[s]);
+        else
+            append(buf, size, &len, "http_responses_total{code=\"%d\"} %lu\n", status_codes[s], sum.responses[s]);
+    }
+
+    append(buf, size, &len, "# HELP http_sent_bytes_total Bytes of headers and bodies sent.\n"
+            "# TYPE http_sent_bytes_total counter\n"
+            "http_sent_bytes_total %lu\n"
+            "# HELP http_received_bytes_total Bytes of request bodies received by uploads.\n"
+            "# TYPE http_received_bytes_total counter\n"
+            "http_received_bytes_total %lu\n", sum.bytes_sent, sum.bytes_received);
+
+    append(buf, size, &len, "# HELP http_connections_active Open connections.\n"
+            "# TYPE http_connections_active gauge\n"
+            "http_connections_active %ld\n"
+            "# HELP http_connections_accepted_total Connections accepted.\n"
+            "# TYPE http_connections_accepted_total counter\n"
+            "http_connections_accepted_total %lu\n"
+            "# HELP http_connection_timeouts_total Connections closed for missing the handshake, header or send deadline.\n"
+            "# TYPE http_connection_timeouts_total counter\n"
+            "http_connection_timeouts_total %lu\n", active, accepted, sum.timeouts);
+
+    append(buf, size, &len, "# HELP http_shed_total Connections turned away by admission control, by reason, plaintext ones with a 503.\n"
+            "# TYPE http_shed_total counter\n");
+    for (int r = 0; r < NSHED; r++)
+        append(buf, size, &len, "http_shed_total{reason=\"%s\"} %lu\n", shed_reasons[r], sum.shed[r]);
+    append(buf, size, &len, "# HELP event_loop_lag_seconds How long ready events wait to be handled, averaged over recent turns, on the worker furthest behind.\n"
+            "# TYPE event_loop_lag_seconds gauge\n"
+            "event_loop_lag_seconds %g\n", lag / 1e6);
+
+    append(buf, size, &len, "# HELP tls_handshakes_total Completed TLS handshakes.\n"
+            "# TYPE tls_handshakes_total counter\n"
+            "tls_handshakes_total{type=\"full\"} %lu\n"
+            "tls_handshakes_total{type=\"resumed\"} %lu\n", full, resumed);
+
+    if (nhandshakers > 0)
+        append(buf, size, &len, "# HELP tls_handshake_queue_depth Connections in the handshake pool, handshaking or done and waiting for a worker.\n"
+                "# TYPE tls_handshake_queue_depth gauge\n"
+                "tls_handshake_queue_depth{stage=\"handshake\"} %ld\n"
+                "tls_handshake_queue_depth{stage=\"handoff\"} %ld\n", handshaking, handed_off);
+
+    append(buf, size, &len, "# HELP access_log_dropped_total Access log records dropped because the log fell behind.\n"
+            "# TYPE access_log_dropped_total counter\n"
+            "access_log_dropped_total %lu\n", log_dropped);
+
+    // from a parsed request to its last byte handed to the kernel
+    append(buf, size, &len, "# HELP http_request_duration_seconds Time to answer a request.\n"
+            "# TYPE http_request_duration_seconds histogram\n");
+    unsigned long count = 0;
+    for (int b = 0; b < LATENCY_BUCKETS - 1; b++) {
+        count += sum.latency[b];
+        append(buf, size, &len, "http_request_duration_seconds_bucket{le=\"%g\"} %lu\n", (double)(1L << b) / 1e6, count);
+    }
+    count += sum.latency[LATENCY_BUCKETS - 1];
+    append(buf, size, &len, "http_request_duration_seconds_bucket{le=\"+Inf\"} %lu\n"
+            "http_request_duration_seconds_sum %g\n"
+            "http_request_duration_seconds_count %lu\n", count, sum.latency_usec / 1e6, count);
+
+    return len < size ? len : size - 1;
+}
@@ -0,0 +1,284 @@
+#include "parser.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+// tchar of RFC 9110, the characters of methods and header names
+static const unsigned char token_chars[256] = {
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1,
+    ['+'] = 1, ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1, ['~'] = 1,
+    ['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1, ['5'] = 1, ['6'] = 1, ['7'] = 1,
+    ['8'] = 1, ['9'] = 1,
+    ['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1, ['G'] = 1, ['H'] = 1,
+    ['I'] = 1, ['J'] = 1, ['K'] = 1, ['L'] = 1, ['M'] = 1, ['N'] = 1, ['O'] = 1, ['P'] = 1,
+    ['Q'] = 1, ['R'] = 1, ['S'] = 1, ['T'] = 1, ['U'] = 1, ['V'] = 1, ['W'] = 1, ['X'] = 1,
+    ['Y'] = 1, ['Z'] = 1,
+    ['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1, ['g'] = 1, ['h'] = 1,
+    ['i'] = 1, ['j'] = 1, ['k'] = 1, ['l'] = 1, ['m'] = 1, ['n'] = 1, ['o'] = 1, ['p'] = 1,
+    ['q'] = 1, ['r'] = 1, ['s'] = 1, ['t'] = 1, ['u'] = 1, ['v'] = 1, ['w'] = 1, ['x'] = 1,
+    ['y'] = 1, ['z'] = 1,
+};
+
+#define is_token(c) (token_chars[(unsigned char)(c)])
+#define is_ctl(c) ((unsigned char)(c) < 0x20 || (c) == 0x7f)
+
+static inline str_view_t make_view(int start, int end)
+{
+    str_view_t view = { start, end - start };
+    return view;
+}
+
+// HTTP/1.<digit>
+static int is_http1(const char *version, int len)
+{
+    return len == HTTP_VERSION_LEN && memcmp(version, "HTTP/1.", 7) == 0 && version[7] >= '0' && version[7] <= '9';
+}
+
+void init_parser(http_parser_t *parser)
+{
+    memset(parser, 0, offsetof(http_parser_t, headers));
+    parser->nheaders = 0;
+    parser->state = PARSE_METHOD;
+}
+
+// scan buf[parser->pos, len), returns PARSE_AGAIN until the blank line ending
+// the header block has been seen. With line_only the header lines are only
+// looked at if their name could be Host, Connection, Content-Length or
+// Transfer-Encoding, the others are skipped to their end in one memchr().
+static int parse(http_parser_t *parser, const char *buf, int len, int line_only)
+{
+    int pos = parser->pos;
+
+    for (; pos < len; pos++) {
+        char c = buf[pos];
+
+        switch (parser->state) {
+            case PARSE_METHOD:
+                if (c == ' ' && pos > parser->mark) {
+                    parser->method = make_view(parser->mark, pos);
+                    parser->mark = pos + 1;
+                    parser->state = PARSE_URL;
+                } else if (!is_token(c)) {
+                    return PARSE_ERROR;
+                }
+                break;
+
+            case PARSE_URL:
+                // the url is the longest part of the request line, skip over
+                // it without going through the switch for every byte
+                while (pos < len && buf[pos] != ' ' && !is_ctl(buf[pos]))
+                    pos++;
+                if (pos == len)
+                    goto again;
+                if (buf[pos] != ' ' || pos == parser->mark)
+                    return PARSE_ERROR;
+                parser->url = make_view(parser->mark, pos);
+                parser->mark = pos + 1;
+                parser->state = PARSE_VERSION;
+                break;
+
+            case PARSE_VERSION:
+                // only HTTP/1.x is spoken here, and the version is echoed in
+                // the status line of every response, so nothing longer gets in
+                if (c == '\r' || c == '\n') {
+                    if (!is_http1(buf + parser->mark, pos - parser->mark))
+                        return PARSE_ERROR;
+                    parser->version = make_view(parser->mark, pos);
+                    parser->state = c == '\r' ? PARSE_LINE_LF : PARSE_HEADER_START;
+                } else if (pos - parser->mark >= HTTP_VERSION_LEN) {
+                    return PARSE_ERROR;
+                }
+                break;
+
+            case PARSE_LINE_LF:
+                if (c != '\n')
+                    return PARSE_ERROR;
+                parser->state = PARSE_HEADER_START;
+                break;
+
+            case PARSE_HEADER_START:
+                if (c == '\r') {
+                    parser->state = PARSE_END_LF;
+                } else if (c == '\n') {
+                    goto done;
+                } else if (line_only && is_token(c) && (c | 0x20) != 'h' && (c | 0x20) != 'c' && (c | 0x20) != 't') {
+                    parser->state = PARSE_SKIP_LINE;
+                } else if (is_token(c)) {
+                    parser->mark = pos;
+                    parser->state = PARSE_HEADER_NAME;
+                } else {
+                    return PARSE_ERROR;
+                }
+                break;
+
+            case PARSE_HEADER_NAME:
+                if (c == ':') {
+                    parser->name = make_view(parser->mark, pos);
+                    parser->state = PARSE_VALUE_START;
+                } else if (!is_token(c)) {
+                    return PARSE_ERROR;
+                }
+                break;
+
+            case PARSE_VALUE_START:
+                if (c == ' ' || c == '\t')
+                    break;
+                parser->mark = pos;
+                parser->state = PARSE_VALUE;
+                // fall through
+
+            case PARSE_VALUE: {
+                const char *eol = memchr(buf + pos, '\n', len - pos);
+                if (eol == NULL) {
+                    pos = len;
+                    goto again;
+                }
+                pos = eol - buf;
+                int end = pos;
+                if (end > parser->mark && buf[end - 1] == '\r')
+                    end--;
+                while (end > parser->mark && (buf[end - 1] == ' ' || buf[end - 1] == '\t'))
+                    end--;
+                for (int i = parser->mark; i < end; i++) {
+                    if (is_ctl(buf[i]) && buf[i] != '\t')
+                        return PARSE_ERROR;
+                }
+
+                if (parser->nheaders == MAX_HEADERS)
+                    return PARSE_TOO_LARGE;
+                http_header_t *header = &parser->headers[parser->nheaders++];
+                header->name = parser->name;
+                header->value = make_view(parser->mark, end);
+                parser->state = PARSE_HEADER_START;
+                break;
+            }
+
+            case PARSE_SKIP_LINE: {
+                const char *eol = memchr(buf + pos, '\n', len - pos);
+                if (eol == NULL) {
+                    pos = len;
+                    goto again;
+                }
+                pos = eol - buf;
+                parser->state = PARSE_HEADER_START;
+                break;
+            }
+
+            case PARSE_END_LF:
+                if (c != '\n')
+                    return PARSE_ERROR;
+                goto done;
+
+            case PARSE_DONE:
+                return PARSE_OK;
+        }
+    }
+
+again:
+    parser->pos = pos;
+    return PARSE_AGAIN;
+
+done:
+    parser->pos = pos + 1;
+    parser->end = pos + 1;
+    parser->state = PARSE_DONE;
+    return PARSE_OK;
+}
+
+int parse_request(http_parser_t *parser, const char *buf, int len)
+{
+    return parse(parser, buf, len, 0);
+}
+
+// for the redirect port, which answers from the request line alone
+int parse_request_line(http_parser_t *parser, const char *buf, int len)
+{
+    return parse(parser, buf, len, 1);
+}
+
+int view_equals(const char *buf, str_view_t view, const char *str)
+{
+    return (int)strlen(str) == view.len && memcmp(buf + view.off, str, view.len) == 0;
+}
+
+int view_case_equals(const char *buf, str_view_t view, const char *str)
+{
+    return (int)strlen(str) == view.len && strncasecmp(buf + view.off, str, view.len) == 0;
+}
+
+// whether a comma separated list like "keep-alive, Upgrade" holds the token
+int view_has_token(const char *buf, str_view_t view, const char *token)
+{
+    int token_len = strlen(token);
+    const char *p = buf + view.off;
+    const char *end = p + view.len;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        const char *start = p;
+        while (p < end && *p != ',')
+            p++;
+        const char *stop = p;
+        while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t'))
+            stop--;
+        if (stop - start == token_len && strncasecmp(start, token, token_len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// whether an Accept-Encoding style list like "gzip;q=0.8, br" accepts the
+// coding, either by name or through "*", and not with q=0
+int view_accepts(const char *buf, str_view_t view, const char *coding)
+{
+    int coding_len = strlen(coding);
+    const char *p = buf + view.off;
+    const char *end = p + view.len;
+    int named = -1, wildcard = -1;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        const char *start = p;
+        while (p < end && *p != ',' && *p != ';' && *p != ' ' && *p != '\t')
+            p++;
+        int len = p - start;
+
+        // a weight of 0, 0.0, 0.00 or 0.000 refuses the coding
+        int accepted = 1;
+        while (p < end && *p != ',') {
+            if (*p == ';') {
+                p++;
+                while (p < end && (*p == ' ' || *p == '\t'))
+                    p++;
+                if (end - p >= 3 && (p[0] == 'q' || p[0] == 'Q') && p[1] == '=' && p[2] == '0') {
+                    accepted = 0;
+                    for (p += 3; p < end && (*p == '.' || *p == '0'); p++)
+                        ;
+                    if (p < end && *p >= '1' && *p <= '9')
+                        accepted = 1;
+                }
+                continue;
+            }
+            p++;
+        }
+
+        if (len == coding_len && strncasecmp(start, coding, len) == 0)
+            named = accepted;
+        else if (len == 1 && *start == '*')
+            wildcard = accepted;
+    }
+
+    return named >= 0 ? named : wildcard > 0;
+}
+
+const http_header_t *find_header(const http_parser_t *parser, const char *buf, const char *name)
+{
+    for (int i = 0; i < parser->nheaders; i++) {
+        if (view_case_equals(buf, parser->headers[i].name, name))
+            return &parser->headers[i];
+    }
+    return NULL;
+}
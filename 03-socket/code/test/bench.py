@@ -0,0 +1,91 @@
+import argparse
+import asyncio
+import ssl
+import time
+
+# concurrency benchmark: every client sends GETs as fast as it can, either one
+# request per connection or, with --keepalive, many requests over one
+# connection (--pipeline N sends N of them back to back). Latency is measured
+# from sending a batch to reading each of its responses.
+#
+#   python3 bench.py --host 10.0.0.1 --port 443 --https -c 1,100,1000
+#   python3 bench.py --host 10.0.0.1 --port 443 --https -c 1 --keepalive
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--host', default='10.0.0.1')
+parser.add_argument('--port', type=int, default=443)
+parser.add_argument('--https', action='store_true')
+parser.add_argument('--url', default='/index.html')
+parser.add_argument('-c', '--concurrency', default='1,100,1000')
+parser.add_argument('-d', '--duration', type=float, default=10)
+parser.add_argument('-t', '--timeout', type=float, default=5)
+parser.add_argument('-k', '--keepalive', action='store_true')
+parser.add_argument('--pipeline', type=int, default=1)
+args = parser.parse_args()
+
+ssl_ctx = None
+if args.https:
+    ssl_ctx = ssl.create_default_context()
+    ssl_ctx.check_hostname = False
+    ssl_ctx.verify_mode = ssl.CERT_NONE
+
+request = ('GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n'
+           % (args.url, args.host, '' if args.keepalive else 'Connection: close\r\n')).encode()
+
+async def read_response(reader):
+    head = await reader.readuntil(b'\r\n\r\n')
+    length = 0
+    for line in head.split(b'\r\n')[1:]:
+        name, _, value = line.partition(b':')
+        if name.strip().lower() == b'content-length':
+            length = int(value)
+    await reader.readexactly(length)
+    return head
+
+async def session(deadline, stats):
+    reader, writer = await asyncio.open_connection(args.host, args.port, ssl=ssl_ctx)
+    try:
+        while time.monotonic() < deadline:
+            sent = time.monotonic()
+            writer.write(request * args.pipeline)
+            await writer.drain()
+            for _ in range(args.pipeline):
+                head = await asyncio.wait_for(read_response(reader), args.timeout)
+                if head.startswith(b'HTTP/1.1 '):
+                    stats['ok'] += 1
+                    stats['latency'].append(time.monotonic() - sent)
+                else:
+                    stats['errors'] += 1
+            if not args.keepalive or b'Connection: close' in head:
+                break
+    finally:
+        writer.close()
+
+async def client(deadline, stats):
+    while time.monotonic() < deadline:
+        try:
+            await asyncio.wait_for(session(deadline, stats), args.duration + args.timeout)
+        except asyncio.IncompleteReadError as e:
+            # the server closed an idle or exhausted keep-alive connection
+            if e.partial:
+                stats['errors'] += 1
+        except (OSError, ssl.SSLError, asyncio.TimeoutError):
+            stats['errors'] += 1
+
+async def run(concurrency):
+    stats = {'ok': 0, 'errors': 0, 'latency': []}
+    start = time.monotonic()
+    deadline = start + args.duration
+    await asyncio.gather(*[client(deadline, stats) for _ in range(concurrency)])
+    elapsed = time.monotonic() - start
+    return stats, elapsed
+
+def percentile(latency, p):
+    return latency[min(len(latency) - 1, int(len(latency) * p / 100))] * 1000 if latency else 0
+
+print('%-12s %-10s %-8s %-10s %-8s %s' % ('concurrency', 'requests', 'errors', 'req/s', 'p50-ms', 'p99-ms'))
+for c in [int(x) for x in args.concurrency.split(',')]:
+    stats, elapsed = asyncio.run(run(c))
+    latency = sorted(stats['latency'])
+    print('%-12d %-10d %-8d %-10.1f %-8.2f %.2f' % (c, stats['ok'], stats['errors'], stats['ok'] / elapsed,
+                                                  percentile(latency, 50), percentile(latency, 99)))
@@ -0,0 +1,61 @@
+import argparse
+import os
+import socket
+import ssl
+import time
+
+# server cpu time per GB served: downloads a file repeatedly and reads the
+# server's utime + stime from /proc before and after.
+#
+#   head -c 1G /dev/urandom > big.bin
+#   python3 cpu_per_gb.py --pid $(pgrep http-server) --port 8080 --url /big.bin
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--pid', type=int, required=True)
+parser.add_argument('--host', default='10.0.0.1')
+parser.add_argument('--port', type=int, default=80)
+parser.add_argument('--https', action='store_true')
+parser.add_argument('--url', default='/index.html')
+parser.add_argument('-n', '--count', type=int, default=5)
+parser.add_argument('--header', action='append', default=[])
+args = parser.parse_args()
+
+ssl_ctx = None
+if args.https:
+    ssl_ctx = ssl.create_default_context()
+    ssl_ctx.check_hostname = False
+    ssl_ctx.verify_mode = ssl.CERT_NONE
+
+request = 'GET %s HTTP/1.1\r\nHost: %s\r\n' % (args.url, args.host)
+for header in args.header:
+    request += header + '\r\n'
+request = (request + '\r\n').encode()
+
+def cpu_seconds(pid):
+    fields = open('/proc/%d/stat' % pid).read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+def download():
+    sock = socket.create_connection((args.host, args.port))
+    if ssl_ctx:
+        sock = ssl_ctx.wrap_socket(sock)
+    sock.sendall(request)
+    buf = bytearray(1 << 20)
+    total = 0
+    while True:
+        n = sock.recv_into(buf)
+        if n == 0:
+            break
+        total += n
+    sock.close()
+    return total
+
+cpu_start = cpu_seconds(args.pid)
+start = time.monotonic()
+total = sum(download() for _ in range(args.count))
+elapsed = time.monotonic() - start
+cpu = cpu_seconds(args.pid) - cpu_start
+
+gb = total / (1 << 30)
+print('bytes %d, wall %.2fs, %.1f MB/s, server cpu %.2fs, %.3f cpu-s/GB'
+      % (total, elapsed, total / elapsed / (1 << 20), cpu, cpu / gb))
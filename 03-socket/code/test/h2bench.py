@@ -0,0 +1,55 @@
+import argparse
+import os
+import shutil
+import statistics
+import subprocess
+import time
+from os.path import dirname, realpath
+
+# page load benchmark: fetches 100 small files the way a browser loads the
+# assets of a page, once multiplexed over a single HTTP/2 connection and once
+# over HTTP/1.1 with up to 6 connections in parallel, and reports the median
+# wall time of each. The files are created under the docroot and removed
+# afterwards, so run it from any directory against a server started in the
+# code directory, e.g.
+#
+#   ./http-server &
+#   python3 test/h2bench.py --host 127.0.0.1
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--host', default='10.0.0.1')
+parser.add_argument('-n', '--files', type=int, default=100)
+parser.add_argument('-s', '--size', type=int, default=2048, help='bytes per file')
+parser.add_argument('-r', '--runs', type=int, default=20)
+parser.add_argument('--h1-connections', type=int, default=6)
+args = parser.parse_args()
+
+docroot = dirname(realpath(__file__)) + '/..'
+bench_dir = docroot + '/h2bench'
+os.makedirs(bench_dir, exist_ok=True)
+for i in range(args.files):
+    with open('%s/%d.js' % (bench_dir, i), 'wb') as f:
+        f.write(os.urandom(args.size))
+# every url needs an output of its own
+urls = []
+for i in range(args.files):
+    urls += ['-o', '/dev/null', 'https://%s/h2bench/%d.js' % (args.host, i)]
+
+def load(options):
+    start = time.monotonic()
+    out = subprocess.run(['curl', '-sk', '-Z', '-w', '%{http_code} %{num_connects}\\n']
+                         + options + urls, capture_output=True, text=True, check=True).stdout
+    elapsed = time.monotonic() - start
+    lines = [line.split() for line in out.splitlines()]
+    assert(len(lines) == args.files and all(code == '200' for code, _ in lines))
+    return elapsed, sum(int(connects) for _, connects in lines)
+
+modes = [('h2', ['--http2']),
+         ('http/1.1', ['--http1.1', '--parallel-max', str(args.h1_connections)])]
+try:
+    print('%-10s %-12s %s' % ('protocol', 'median-ms', 'connections'))
+    for name, options in modes:
+        runs = [load(options) for _ in range(args.runs)]
+        print('%-10s %-12.1f %d' % (name, statistics.median(t for t, _ in runs) * 1000, runs[0][1]))
+finally:
+    shutil.rmtree(bench_dir)
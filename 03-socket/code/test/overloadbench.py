@@ -0,0 +1,86 @@
+import argparse
+import csv
+import io
+import os
+import subprocess
+import time
+from os.path import dirname, realpath
+
+# overload benchmark: finds the request rate the server saturates at with a
+# closed-loop run, then offers it 1x and 2x that rate open-loop, a new
+# connection per request, once with admission control turned off and once
+# with it on. Reports the goodput (responses within the clients' deadline),
+# the requests shed with a 503 and the latency of the successful ones. The
+# requests ask for a file written here, big enough that serving it costs
+# more than a 503 does.
+#
+# The server is started here, in the code directory, on the plaintext port.
+# When loadgen shares the cores with it, give the server a cgroup with a cpu
+# quota so that it saturates before loadgen does, e.g.
+#
+#   make && make bench
+#   mkdir /sys/fs/cgroup/cpu/overload
+#   echo 10000 > /sys/fs/cgroup/cpu/overload/cpu.cfs_period_us
+#   echo 1500 > /sys/fs/cgroup/cpu/overload/cpu.cfs_quota_us
+#   python3 test/overloadbench.py --cgroup /sys/fs/cgroup/cpu/overload
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--port', type=int, default=8080, help='plaintext port the server is started on')
+parser.add_argument('-d', '--duration', type=float, default=10, help='seconds per run')
+parser.add_argument('-c', '--concurrency', type=int, default=4000,
+                    help='connections loadgen may have open in the open-loop runs')
+parser.add_argument('-r', '--rate', type=float, help='saturation rate (default: measured)')
+parser.add_argument('--factors', default='1,2', help='multiples of the saturation rate offered')
+parser.add_argument('-s', '--size', type=int, default=256, help='KB of the file requested')
+parser.add_argument('--deadline', type=float, default=1, help='seconds before a client gives up')
+parser.add_argument('--cgroup', help='cgroup directory the server is started in')
+parser.add_argument('--server-args', default='', help='more options for both servers')
+args = parser.parse_args()
+
+docroot = dirname(realpath(__file__)) + '/..'
+modes = [('off', ['--shed-queue', '0', '--shed-lag', '0']),
+         ('on', [])]
+
+def join_cgroup():
+    with open(args.cgroup + '/cgroup.procs', 'w') as f:
+        f.write(str(os.getpid()))
+
+def start_server(options):
+    server = subprocess.Popen(['./http-server', '-P', str(args.port)] + options + args.server_args.split(),
+                              cwd=docroot, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL,
+                              preexec_fn=join_cgroup if args.cgroup else None)
+    time.sleep(0.5)
+    return server
+
+def loadgen(options):
+    out = subprocess.run([docroot + '/loadgen', '-p', str(args.port), '-d', str(args.duration),
+                          '-T', str(args.deadline), '-u', '/overloadbench.bin'] + options,
+                         capture_output=True, text=True, check=True).stdout
+    return [row for row in csv.DictReader(io.StringIO(out)) if row['kind'] == 'all'][0]
+
+def run(options, load):
+    server = start_server(options)
+    try:
+        return loadgen(load)
+    finally:
+        server.terminate()
+        server.wait()
+
+with open(docroot + '/overloadbench.bin', 'wb') as f:
+    f.write(os.urandom(args.size * 1024))
+try:
+    rate = args.rate
+    if rate is None:
+        rate = float(run(modes[0][1], ['-c', '256'])['req_per_s'])
+        print('saturation at %.0f req/s' % rate)
+
+    print('%-10s %-7s %-10s %-10s %-10s %-8s %-10s %s' % ('admission', 'load', 'offered', 'goodput',
+                                                            'shed/s', 'errors', 'p50-ms', 'p99-ms'))
+    for factor in [float(f) for f in args.factors.split(',')]:
+        for name, options in modes:
+            row = run(options, ['-c', str(args.concurrency), '-r', str(rate * factor)])
+            print('%-10s %-7s %-10.0f %-10s %-10.0f %-8s %-10.1f %.1f' % (
+                name, '%gx' % factor, rate * factor, row['req_per_s'], int(row['shed']) / args.duration,
+                row['errors'], float(row['p50_us']) / 1e3, float(row['p99_us']) / 1e3))
+finally:
+    os.remove(docroot + '/overloadbench.bin')
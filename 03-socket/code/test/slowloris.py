@@ -0,0 +1,50 @@
+import argparse
+import csv
+import io
+import re
+import subprocess
+from os.path import dirname, realpath
+
+# slowloris test: measures keep-alive throughput with the load generator, then
+# again while it also holds 10k connections that trickle a header line every
+# second and never finish (on the tls port: never handshake). The server has
+# to keep serving the real clients and close the slow ones once their header
+# or handshake deadline passes. Start the server first, e.g.
+#
+#   ./http-server -P 8080 --header-timeout 5 &
+#   python3 test/slowloris.py --port 8080
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--port', type=int, default=443)
+parser.add_argument('--https', action='store_true')
+parser.add_argument('-n', '--connections', type=int, default=10000)
+parser.add_argument('-d', '--duration', type=float, default=15)
+parser.add_argument('--min-ratio', type=float, default=0.5,
+                    help='throughput under attack relative to the baseline, at least')
+args = parser.parse_args()
+
+loadgen = dirname(realpath(__file__)) + '/../loadgen'
+common = [loadgen, '-k', '-c', '20', '-p', str(args.port), '-d', str(args.duration), '-W', '3']
+if args.https or args.port == 443:
+    common.append('--tls')
+
+def run(extra):
+    out = subprocess.run(common + extra, capture_output=True, text=True, check=True)
+    rows = {row['kind']: row for row in csv.DictReader(io.StringIO(out.stdout))}
+    return rows['all'], out.stderr
+
+baseline, _ = run(['-l', 'baseline'])
+attacked, log = run(['-l', 'slowloris', '--slowloris', str(args.connections)])
+print('%-10s %-10s %-8s %s' % ('run', 'req/s', 'errors', 'p99-us'))
+for row in (baseline, attacked):
+    print('%-10s %-10s %-8s %s' % (row['label'], row['req_per_s'], row['errors'], row['p99_us']))
+print(log.strip())
+
+held, closed = map(int, re.search(r'(\d+) of \d+ connections held on average, (\d+) closed', log).groups())
+ratio = float(attacked['req_per_s']) / float(baseline['req_per_s'])
+print('throughput ratio %.2f' % ratio)
+
+assert(int(attacked['errors']) == 0)
+assert(held > args.connections * 0.9)
+assert(closed > 0)
+assert(ratio >= args.min_ratio)
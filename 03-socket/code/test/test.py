@@ -1,4 +1,8 @@
+import os
 import requests
+import socket
+import ssl
+import subprocess
 from os.path import dirname, realpath
 
 requests.packages.urllib3.disable_warnings()
@@ -10,6 +14,10 @@ timeout = 2 # 2 seconds
 r = requests.get('http://10.0.0.1/index.html', allow_redirects=False, timeout = timeout)
 assert(r.status_code == 301 and r.headers['Location'] == 'https://10.0.0.1/index.html')
 
+# http 301 to the host the client asked for, without its port
+r = requests.get('http://10.0.0.1/index.html', headers={'Host': '10.0.0.1:80'}, allow_redirects=False, timeout = timeout)
+assert(r.status_code == 301 and r.headers['Location'] == 'https://10.0.0.1/index.html')
+
 # https 200 OK
 r = requests.get('https://10.0.0.1/index.html', verify=False, timeout = timeout)
 assert(r.status_code == 200 and open(test_dir + '/../index.html', 'rb').read() == r.content)
@@ -35,3 +43,115 @@ assert(r.status_code == 206 and open(test_dir + '/../index.html', 'rb').read()[1
 headers = { 'Range': 'bytes=100-' }
 r = requests.get('http://10.0.0.1/index.html', headers=headers, verify=False, timeout = timeout)
 assert(r.status_code == 206 and open(test_dir + '/../index.html', 'rb').read()[100:] == r.content)
+
+# keep-alive
+s = requests.Session()
+r = s.get('https://10.0.0.1/index.html', verify=False, timeout = timeout)
+assert(r.status_code == 200 and r.headers['Connection'] == 'keep-alive')
+r = s.get('https://10.0.0.1/notfound.html', verify=False, timeout = timeout)
+assert(r.status_code == 404 and r.headers['Content-Length'] == '0')
+
+# http 206 suffix range
+headers = { 'Range': 'bytes=-100' }
+r = requests.get('http://10.0.0.1/index.html', headers=headers, verify=False, timeout = timeout)
+assert(r.status_code == 206 and open(test_dir + '/../index.html', 'rb').read()[-100:] == r.content)
+
+# http 206 multipart/byteranges
+headers = { 'Range': 'bytes=0-99,1000-1999' }
+r = requests.get('http://10.0.0.1/index.html', headers=headers, verify=False, timeout = timeout)
+assert(r.status_code == 206 and r.headers['Content-Type'].startswith('multipart/byteranges'))
+assert(open(test_dir + '/../index.html', 'rb').read()[1000:2000] in r.content)
+
+# http 416
+headers = { 'Range': 'bytes=100000000-' }
+r = requests.get('http://10.0.0.1/index.html', headers=headers, verify=False, timeout = timeout)
+assert(r.status_code == 416)
+
+# gzip content coding
+headers = { 'Accept-Encoding': 'gzip' }
+r = requests.get('http://10.0.0.1/index.html', headers=headers, verify=False, timeout = timeout)
+assert(r.status_code == 200 and r.headers['Content-Encoding'] == 'gzip' and r.headers['Vary'] == 'Accept-Encoding')
+assert(open(test_dir + '/../index.html', 'rb').read() == r.content)
+
+# conditional requests
+r = requests.get('http://10.0.0.1/index.html', verify=False, timeout = timeout)
+etag = r.headers['ETag']
+r = requests.get('http://10.0.0.1/index.html', headers={ 'If-None-Match': etag }, verify=False, timeout = timeout)
+assert(r.status_code == 304 and r.content == b'' and r.headers['ETag'] == etag)
+headers = { 'Range': 'bytes=0-99', 'If-Range': '"stale"' }
+r = requests.get('http://10.0.0.1/index.html', headers=headers, verify=False, timeout = timeout)
+assert(r.status_code == 200)
+
+# raw requests, the responses read until the server closes
+def raw_request(port, request):
+    with socket.create_connection(('10.0.0.1', port), timeout=timeout) as s:
+        s.sendall(request)
+        response = b''
+        while True:
+            data = s.recv(65536)
+            if not data:
+                return response
+            response += data
+
+# only HTTP/1.x is spoken, the version is echoed in every status line
+response = raw_request(80, b'GET /index.html ' + b'A' * 3000 + b'\r\n\r\n')
+assert(response.startswith(b'HTTP/1.1 400 '))
+response = raw_request(80, b'GET /index.html HTTP/2.0\r\n\r\n')
+assert(response.startswith(b'HTTP/1.1 400 '))
+
+# HEAD gets no body, on a kept-alive connection the pipelined request after
+# it is answered right behind its headers
+with socket.create_connection(('10.0.0.1', 443), timeout=timeout) as s:
+    context = ssl.create_default_context()
+    context.check_hostname = False
+    context.verify_mode = ssl.CERT_NONE
+    with context.wrap_socket(s) as t:
+        t.sendall(b'HEAD /index.html HTTP/1.1\r\nHost: 10.0.0.1\r\n\r\n'
+                  b'GET /notfound.html HTTP/1.1\r\nHost: 10.0.0.1\r\nConnection: close\r\n\r\n')
+        response = b''
+        while True:
+            data = t.recv(65536)
+            if not data:
+                break
+            response += data
+head, _, rest = response.partition(b'\r\n\r\n')
+assert(head.startswith(b'HTTP/1.1 200 ') and rest.startswith(b'HTTP/1.1 404 '))
+
+# HTTP/2 picked by ALPN, requests only speaks HTTP/1.1 so curl does these
+def h2_get(url, *options):
+    out = subprocess.run(['curl', '-sk', '--http2', '-w', '\n%{http_version} %{http_code}', *options, url],
+                         capture_output=True, timeout=timeout, check=True).stdout
+    body, _, status = out.rpartition(b'\n')
+    version, code = status.split()
+    return version, int(code), body
+
+version, code, body = h2_get('https://10.0.0.1/index.html')
+assert(version == b'2' and code == 200 and open(test_dir + '/../index.html', 'rb').read() == body)
+version, code, body = h2_get('https://10.0.0.1/index.html', '-r', '100-200')
+assert(version == b'2' and code == 206 and open(test_dir + '/../index.html', 'rb').read()[100:201] == body)
+version, code, body = h2_get('https://10.0.0.1/notfound.html')
+assert(version == b'2' and code == 404 and body == b'')
+
+# uploads, the server has to run with --plain-port 8080 --max-upload 1m. Port
+# 80 only redirects, plaintext uploads go to the files port, where the body is
+# spliced into the file
+plain = 'http://10.0.0.1:8080'
+data = bytes(range(256)) * 400
+r = requests.put(plain + '/upload.bin', data=data, timeout = timeout)
+assert(r.status_code in (201, 204))
+r = requests.get(plain + '/upload.bin', timeout = timeout)
+assert(r.status_code == 200 and r.content == data)
+# a generator is sent chunked
+r = requests.put('https://10.0.0.1/upload.bin', data=iter([data[:1000], data[1000:]]), verify=False, timeout = timeout)
+assert(r.status_code == 204)
+r = requests.get('https://10.0.0.1/upload.bin', verify=False, timeout = timeout)
+assert(r.status_code == 200 and r.content == data)
+version, code, body = h2_get('https://10.0.0.1/upload.bin', '-X', 'PUT', '--data-binary', 'h2 body')
+assert(version == b'2' and code == 204 and open(test_dir + '/../upload.bin', 'rb').read() == b'h2 body')
+r = requests.put(plain + '/nodir/upload.bin', data=data, timeout = timeout)
+assert(r.status_code == 404)
+# curl waits for 100 Continue before a large body, the 413 comes instead
+out = subprocess.run(['curl', '-s', '-o', '/dev/null', '-w', '%{http_code}', '-X', 'PUT', '--data-binary', '@-',
+                      '-H', 'Expect: 100-continue', plain + '/upload.bin'], input=b'x' * 2000000, capture_output=True, timeout=timeout).stdout
+assert(out == b'413')
+os.remove(test_dir + '/../upload.bin')
@@ -0,0 +1,72 @@
+import argparse
+import os
+import subprocess
+import threading
+import time
+from os.path import dirname, realpath
+
+# upload benchmark: PUTs a multi-GB body with curl, framed by Content-Length
+# and chunked, in plaintext (spliced into the file) and over TLS with
+# HTTP/1.1 and HTTP/2 (through the body buffer), and reports the throughput
+# and the highest RSS of the server while it ran. The body is a sparse file,
+# so reading it costs curl next to nothing. Start the server in the code
+# directory with a big enough limit, e.g.
+#
+#   ./http-server -P 8080 --max-upload 8g &
+#   python3 test/uploadbench.py --size 4
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--host', default='127.0.0.1')
+parser.add_argument('--port', type=int, default=8080, help='plaintext port of the server')
+parser.add_argument('-s', '--size', type=float, default=4, help='GB per upload')
+parser.add_argument('--pid', type=int, help='server pid (default: the one http-server)')
+args = parser.parse_args()
+
+pid = args.pid or int(subprocess.run(['pgrep', '-x', 'http-server'], capture_output=True,
+                                     text=True, check=True).stdout.split()[0])
+docroot = dirname(realpath(__file__)) + '/..'
+source = '/tmp/uploadbench.src'
+with open(source, 'wb') as f:
+    f.truncate(int(args.size * (1 << 30)))
+
+def rss_kb():
+    with open('/proc/%d/status' % pid) as f:
+        for line in f:
+            if line.startswith('VmRSS:'):
+                return int(line.split()[1])
+
+def upload(options, url, stdin=None):
+    peak = [rss_kb()]
+    done = threading.Event()
+    def sample():
+        while not done.wait(0.05):
+            peak[0] = max(peak[0], rss_kb())
+    sampler = threading.Thread(target=sample)
+    sampler.start()
+    start = time.monotonic()
+    code = subprocess.run(['curl', '-sk', '-o', '/dev/null', '-w', '%{http_code}'] + options + [url],
+                          stdin=stdin, capture_output=True, text=True, check=True).stdout
+    elapsed = time.monotonic() - start
+    done.set()
+    sampler.join()
+    assert(code in ('201', '204'))
+    return elapsed, peak[0]
+
+plain = 'http://%s:%d/uploadbench.bin' % (args.host, args.port)
+tls = 'https://%s/uploadbench.bin' % args.host
+modes = [('http content-length', ['-T', source], plain),
+         ('http chunked', ['-T', '-'], plain),
+         ('https/1.1', ['--http1.1', '-T', source], tls),
+         ('https/2', ['--http2', '-T', source], tls)]
+try:
+    print('%-22s %-10s %s' % ('mode', 'MB/s', 'peak-rss-MB'))
+    for name, options, url in modes:
+        # curl chunks what it reads from stdin
+        with open(source, 'rb') as stdin:
+            elapsed, peak = upload(options, url, stdin)
+        assert(os.path.getsize(docroot + '/uploadbench.bin') == int(args.size * (1 << 30)))
+        print('%-22s %-10.0f %.1f' % (name, args.size * 1024 / elapsed, peak / 1024))
+finally:
+    os.remove(source)
+    if os.path.exists(docroot + '/uploadbench.bin'):
+        os.remove(docroot + '/uploadbench.bin')
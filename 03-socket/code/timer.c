@@ -0,0 +1,51 @@
+#include "timer.h"
+
+void init_wheel(timer_wheel_t *wheel, long now)
+{
+    for (int i = 0; i < WHEEL_SLOTS; i++)
+        init_list_head(&wheel->slots[i]);
+    wheel->tick = now;
+    wheel->armed = 0;
+}
+
+void arm_timer(timer_wheel_t *wheel, wheel_timer_t *timer, long expires)
+{
+    if (timer->armed)
+        list_delete_entry(&timer->list);
+    else
+        wheel->armed++;
+
+    // a deadline already passed fires on the next tick that runs
+    long tick = expires < wheel->tick ? wheel->tick : expires;
+    list_add_tail(&timer->list, &wheel->slots[tick & (WHEEL_SLOTS - 1)]);
+    timer->expires = expires;
+    timer->armed = 1;
+}
+
+void cancel_timer(timer_wheel_t *wheel, wheel_timer_t *timer)
+{
+    if (!timer->armed)
+        return;
+    list_delete_entry(&timer->list);
+    timer->armed = 0;
+    wheel->armed--;
+}
+
+void expire_timers(timer_wheel_t *wheel, long now, void (*fire)(wheel_timer_t *, void *), void *arg)
+{
+    // after a long stall every slot is due once
+    if (now - wheel->tick >= WHEEL_SLOTS)
+        wheel->tick = now - WHEEL_SLOTS + 1;
+
+    for (; wheel->tick <= now; wheel->tick++) {
+        struct list_head *slot = &wheel->slots[wheel->tick & (WHEEL_SLOTS - 1)];
+        wheel_timer_t *timer, *q;
+
+        list_for_each_entry_safe(timer, q, slot, list) {
+            if (timer->expires > now)
+                continue;               // a later round
+            cancel_timer(wheel, timer);
+            fire(timer, arg);
+        }
+    }
+}
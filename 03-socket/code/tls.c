@@ -0,0 +1,171 @@
+#include "tls.h"
+#include "config.h"
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the one context every worker creates its connections from, so they all
+// share the session cache and the ticket keys
+SSL_CTX *ssl_ctx;
+
+// ticket_keys[0] encrypts new tickets, the older ones only decrypt
+static ticket_key_t ticket_keys[TICKET_KEYS];
+static int nticket_keys;
+static pthread_mutex_t ticket_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static time_t now_sec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+// make a fresh key the current one, called with ticket_lock held
+static void rotate_ticket_keys(time_t now)
+{
+    memmove(&ticket_keys[1], &ticket_keys[0], (TICKET_KEYS - 1) * sizeof(ticket_key_t));
+    if (nticket_keys < TICKET_KEYS)
+        nticket_keys++;
+
+    ticket_key_t *key = &ticket_keys[0];
+    if (RAND_bytes(key->name, sizeof(key->name)) <= 0
+            || RAND_bytes(key->aes_key, sizeof(key->aes_key)) <= 0
+            || RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) <= 0) {
+        fprintf(stderr, "generate session ticket key failed\n");
+        exit(1);
+    }
+    key->created = now;
+}
+
+static int set_ticket_hmac(EVP_MAC_CTX *hctx, ticket_key_t *key)
+{
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key->hmac_key, sizeof(key->hmac_key)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+        OSSL_PARAM_construct_end(),
+    };
+    return EVP_MAC_CTX_set_params(hctx, params);
+}
+
+// encrypt new tickets with the current key and accept tickets of the
+// previous keys, asking the client to take a fresh ticket for those
+static int ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+        EVP_CIPHER_CTX *ctx, EVP_MAC_CTX *hctx, int enc)
+{
+    ticket_key_t key;
+    int ret = 1;
+
+    pthread_mutex_lock(&ticket_lock);
+    time_t now = now_sec();
+    if (now - ticket_keys[0].created >= config.ticket_rotate)
+        rotate_ticket_keys(now);
+
+    if (enc) {
+        key = ticket_keys[0];
+    } else {
+        int i;
+        for (i = 0; i < nticket_keys; i++) {
+            if (memcmp(key_name, ticket_keys[i].name, 16) == 0)
+                break;
+        }
+        if (i == nticket_keys) {
+            // unknown or expired key, fall back to a full handshake
+            pthread_mutex_unlock(&ticket_lock);
+            return 0;
+        }
+        key = ticket_keys[i];
+        if (i > 0)
+            ret = 2;
+    }
+    pthread_mutex_unlock(&ticket_lock);
+
+    if (enc) {
+        if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0)
+            return -1;
+        memcpy(key_name, key.name, 16);
+        if (!EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv))
+            return -1;
+    } else {
+        if (!EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv))
+            return -1;
+    }
+    if (!set_ticket_hmac(hctx, &key))
+        return -1;
+
+    return ret;
+}
+
+// h2 for the clients that offer it, HTTP/1.1 for everyone else
+static int alpn_select_cb(SSL *ssl, const unsigned char **out, unsigned char *outlen,
+        const unsigned char *in, unsigned int inlen, void *arg)
+{
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    const unsigned char *server = config.http2 ? protos : protos + 3;
+    unsigned int server_len = config.http2 ? sizeof(protos) - 1 : sizeof(protos) - 4;
+
+    if (SSL_select_next_proto((unsigned char **)out, outlen, server, server_len, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+void init_ssl_ctx()
+{
+    // init SSL Library
+    SSL_library_init();
+    OpenSSL_add_all_algorithms();
+    SSL_load_error_strings();
+
+    // enable TLS method
+    const SSL_METHOD *method = TLS_server_method();
+    SSL_CTX *ctx = SSL_CTX_new(method);
+
+    // load certificate and private key
+    if (SSL_CTX_use_certificate_file(ctx, "./keys/cnlab.cert", SSL_FILETYPE_PEM) <= 0) {
+        perror("load cert failed");
+        exit(1);
+    }
+    if (SSL_CTX_use_PrivateKey_file(ctx, "./keys/cnlab.prikey", SSL_FILETYPE_PEM) <= 0) {
+        perror("load prikey failed");
+        exit(1);
+    }
+
+    // the socket is non-blocking, so a write may be retried with a moved
+    // buffer and may complete partially
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    // let the kernel encrypt records when the tls module and the negotiated
+    // cipher allow it, so bodies can go out with SSL_sendfile()
+    if (config.use_ktls)
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+
+    // many clients just close the socket, a missing close_notify must not
+    // count as an error that evicts their session
+    SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+
+    // returning clients resume instead of redoing the key exchange: TLS 1.2
+    // clients by session id from the cache, both 1.2 and 1.3 by ticket
+    const unsigned char sid_ctx[] = "http-server";
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    if (config.session_cache_size > 0) {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(ctx, config.session_cache_size);
+    } else {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+    }
+
+    if (config.ticket_rotate > 0) {
+        rotate_ticket_keys(now_sec());
+        SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, ticket_key_cb);
+    } else {
+        SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+    }
+
+    SSL_CTX_set_alpn_select_cb(ctx, alpn_select_cb, NULL);
+
+    ssl_ctx = ctx;
+}
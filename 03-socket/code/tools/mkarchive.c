@@ -0,0 +1,415 @@
+// mkarchive: pack a docroot into the archive http-server serves with
+// --archive, see include/archive.h for the layout. Every regular file below
+// the docroot is packed under the url it is served at, with its 200 OK
+// headers rendered and, for text formats that shrink, the gzip copy the
+// server would make, so it keeps the etag the docroot gives.
+//
+//   make mkarchive
+//   ./mkarchive . /tmp/docroot.archive
+//   ./http-server --archive /tmp/docroot.archive
+
+#include "archive.h"
+#include "cache.h"
+#include "upload.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// urls longer than this are never looked up, the server normalizes into a
+// buffer of this size
+#define MAX_URL_LEN 255
+// urls per bucket of the perfect hash on average
+#define BUCKET_LOAD 4
+// displacements tried for one bucket before the slots are doubled
+#define MAX_SEED 1000000
+
+typedef struct packed_file {
+    char *url;
+    char *path;
+    struct stat st;
+    char *data;                         // loaded while writing
+    char *gzip;
+    unsigned long gzip_size;
+    char header[ARCHIVE_MAX_HEADER];
+    int header_len;
+    char gzip_header[ARCHIVE_MAX_HEADER];
+    int gzip_header_len;
+} packed_file_t;
+
+static struct {
+    int gzip;
+    int verbose;
+} options = { .gzip = 1 };
+
+static packed_file_t *files;
+static int nfiles, files_size;
+static dev_t out_dev;
+static ino_t out_ino;
+
+// collect the regular files below path, url is how the directory appears in
+// request urls ("" for the docroot)
+static void add_dir(const char *path, const char *url)
+{
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        char sub_path[PATH_MAX], sub_url[PATH_MAX];
+        snprintf(sub_path, sizeof(sub_path), "%s/%s", path, de->d_name);
+        snprintf(sub_url, sizeof(sub_url), "%s/%s", url, de->d_name);
+
+        // symlinks are followed, like open() does when serving
+        struct stat st;
+        if (stat(sub_path, &st) < 0)
+            continue;
+        if (S_ISDIR(st.st_mode)) {
+            add_dir(sub_path, sub_url);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) || (st.st_dev == out_dev && st.st_ino == out_ino))
+            continue;
+        // an upload being written, or left behind by a crash
+        if (is_upload_part(de->d_name))
+            continue;
+        if (strlen(sub_url) > MAX_URL_LEN) {
+            fprintf(stderr, "skipping %s, its url is too long\n", sub_path);
+            continue;
+        }
+
+        if (nfiles == files_size) {
+            files_size = files_size * 2 + 64;
+            files = realloc(files, files_size * sizeof(packed_file_t));
+        }
+        packed_file_t *file = &files[nfiles++];
+        memset(file, 0, sizeof(*file));
+        file->url = strdup(sub_url);
+        file->path = strdup(sub_path);
+        file->st = st;
+    }
+    closedir(dir);
+}
+
+static int compare_urls(const void *a, const void *b)
+{
+    return strcmp(((const packed_file_t *)a)->url, ((const packed_file_t *)b)->url);
+}
+
+static char *read_file(packed_file_t *file)
+{
+    char *data = malloc(file->st.st_size > 0 ? file->st.st_size : 1);
+    int fd = open(file->path, O_RDONLY);
+    if (data == NULL || fd < 0) {
+        perror(file->path);
+        exit(1);
+    }
+    for (off_t done = 0; done < file->st.st_size; ) {
+        ssize_t n = pread(fd, data + done, file->st.st_size - done, done);
+        if (n <= 0) {
+            fprintf(stderr, "%s: changed while packing\n", file->path);
+            exit(1);
+        }
+        done += n;
+    }
+    close(fd);
+    return data;
+}
+
+// a gzip copy of the data, kept only if it is smaller
+static void compress_file(packed_file_t *file)
+{
+    if (!options.gzip || !compressible(file->url) || file->st.st_size < GZIP_MIN_SIZE)
+        return;
+
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return;
+    uLong bound = deflateBound(&zs, file->st.st_size);
+    file->gzip = malloc(bound);
+    zs.next_in = (Bytef *)file->data;
+    zs.avail_in = file->st.st_size;
+    zs.next_out = (Bytef *)file->gzip;
+    zs.avail_out = bound;
+    if (file->gzip == NULL || deflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out >= (uLong)file->st.st_size) {
+        free(file->gzip);
+        file->gzip = NULL;
+    } else {
+        file->gzip_size = zs.total_out;
+    }
+    deflateEnd(&zs);
+}
+
+// the Content-Length and validators the server would send after the status
+// line, the etag of a gzip copy is one of its own
+static int render_header(packed_file_t *file, unsigned long size, const char *suffix, char *buf)
+{
+    char last_modified[32];
+    struct tm tm;
+    gmtime_r(&file->st.st_mtim.tv_sec, &tm);
+    strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    return snprintf(buf, ARCHIVE_MAX_HEADER, "Content-Length: %lu\r\n"
+            "ETag: \"%lx-%llx-%llx%s\"\r\nLast-Modified: %s\r\n", size,
+            (unsigned long)file->st.st_ino, (unsigned long long)file->st.st_size,
+            (unsigned long long)file->st.st_mtim.tv_sec * 1000000000ULL + file->st.st_mtim.tv_nsec,
+            suffix, last_modified);
+}
+
+static uint32_t next_pow2(uint32_t n)
+{
+    uint32_t p = 1;
+    while (p < n)
+        p <<= 1;
+    return p;
+}
+
+typedef struct bucket {
+    uint32_t index;
+    int nurls;
+    int *urls;
+} bucket_t;
+
+static int compare_buckets(const void *a, const void *b)
+{
+    return ((const bucket_t *)b)->nurls - ((const bucket_t *)a)->nurls;
+}
+
+// hash and displace: fill the biggest buckets first, trying seeds until all
+// urls of a bucket land in distinct free slots. Returns -1 if some bucket
+// finds no seed, the caller then tries again with more slots.
+static int build_index(uint32_t nbuckets, uint32_t nslots, uint32_t *seeds, uint32_t *slots)
+{
+    bucket_t *buckets = calloc(nbuckets, sizeof(bucket_t));
+    for (uint32_t b = 0; b < nbuckets; b++)
+        buckets[b].index = b;
+    for (int i = 0; i < nfiles; i++) {
+        bucket_t *bucket = &buckets[archive_hash(files[i].url, strlen(files[i].url), 0) & (nbuckets - 1)];
+        bucket->urls = realloc(bucket->urls, (bucket->nurls + 1) * sizeof(int));
+        bucket->urls[bucket->nurls++] = i;
+    }
+    qsort(buckets, nbuckets, sizeof(bucket_t), compare_buckets);
+
+    memset(seeds, 0, nbuckets * sizeof(uint32_t));
+    memset(slots, 0xff, nslots * sizeof(uint32_t));
+    uint32_t *taken = malloc(nfiles * sizeof(uint32_t));
+    int ret = 0;
+    for (uint32_t b = 0; b < nbuckets && buckets[b].nurls > 0 && ret == 0; b++) {
+        bucket_t *bucket = &buckets[b];
+        uint32_t seed;
+        for (seed = 1; seed <= MAX_SEED; seed++) {
+            int n;
+            for (n = 0; n < bucket->nurls; n++) {
+                const char *url = files[bucket->urls[n]].url;
+                uint32_t slot = archive_hash(url, strlen(url), seed) & (nslots - 1);
+                int clash = slots[slot] != ARCHIVE_EMPTY;
+                for (int k = 0; k < n && !clash; k++)
+                    clash = taken[k] == slot;
+                if (clash)
+                    break;
+                taken[n] = slot;
+            }
+            if (n == bucket->nurls)
+                break;
+        }
+        if (seed > MAX_SEED) {
+            ret = -1;
+            break;
+        }
+        seeds[bucket->index] = seed;
+        for (int n = 0; n < bucket->nurls; n++)
+            slots[taken[n]] = bucket->urls[n];
+    }
+
+    for (uint32_t b = 0; b < nbuckets; b++)
+        free(buckets[b].urls);
+    free(buckets);
+    free(taken);
+    return ret;
+}
+
+static uint64_t align_up(uint64_t off, uint64_t align)
+{
+    return (off + align - 1) / align * align;
+}
+
+static void write_at(int fd, const void *buf, uint64_t len, uint64_t off)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, off);
+        if (n <= 0) {
+            perror("write archive failed");
+            exit(1);
+        }
+        p += n;
+        off += n;
+        len -= n;
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [options] DOCROOT ARCHIVE\n"
+            "  -n, --no-gzip       leave out the gzip copies of text files\n"
+            "  -v, --verbose       list the files packed\n"
+            "  -h, --help          show this help\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        { "no-gzip",        no_argument,       NULL, 'n' },
+        { "verbose",        no_argument,       NULL, 'v' },
+        { "help",           no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "nvh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                options.gzip = 0;
+                break;
+            case 'v':
+                options.verbose = 1;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    const char *docroot = argv[optind], *out_path = argv[optind + 1];
+
+    // written next to the archive and renamed over it, a running server keeps
+    // the mapping of the old one
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    struct stat out_st;
+    if (fd < 0 || fstat(fd, &out_st) < 0) {
+        perror(tmp_path);
+        return 1;
+    }
+    out_dev = out_st.st_dev;
+    out_ino = out_st.st_ino;
+
+    add_dir(docroot, "");
+    if (nfiles == 0) {
+        fprintf(stderr, "%s: no files to pack\n", docroot);
+        unlink(tmp_path);
+        return 1;
+    }
+    // the same docroot packs into the same index
+    qsort(files, nfiles, sizeof(packed_file_t), compare_urls);
+
+    archive_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ARCHIVE_MAGIC, 8);
+    header.version = ARCHIVE_VERSION;
+    header.nfiles = nfiles;
+    header.nbuckets = next_pow2(nfiles / BUCKET_LOAD + 1);
+    header.nslots = next_pow2(nfiles);
+    uint32_t *seeds = NULL, *slots = NULL;
+    while (1) {
+        seeds = realloc(seeds, header.nbuckets * sizeof(uint32_t));
+        slots = realloc(slots, header.nslots * sizeof(uint32_t));
+        if (build_index(header.nbuckets, header.nslots, seeds, slots) == 0)
+            break;
+        if (header.nslots >= (uint32_t)nfiles * 64) {
+            fprintf(stderr, "no perfect hash for the urls found\n");
+            unlink(tmp_path);
+            return 1;
+        }
+        header.nslots *= 2;
+    }
+
+    // tables, then the urls, then the data on pages of their own
+    header.seeds_off = sizeof(header);
+    header.slots_off = header.seeds_off + header.nbuckets * sizeof(uint32_t);
+    header.files_off = align_up(header.slots_off + header.nslots * sizeof(uint32_t), 8);
+    uint64_t strings_off = header.files_off + (uint64_t)nfiles * sizeof(archive_file_t);
+
+    archive_file_t *records = calloc(nfiles, sizeof(archive_file_t));
+    uint64_t off = strings_off;
+    for (int i = 0; i < nfiles; i++) {
+        records[i].url_off = off;
+        records[i].url_len = strlen(files[i].url);
+        off += records[i].url_len + 1;
+        records[i].header_off = off;
+        off += ARCHIVE_MAX_HEADER;
+        records[i].gzip_header_off = off;
+        off += ARCHIVE_MAX_HEADER;
+    }
+
+    unsigned long packed = 0, gzipped = 0;
+    for (int i = 0; i < nfiles; i++) {
+        packed_file_t *file = &files[i];
+        archive_file_t *record = &records[i];
+        file->data = read_file(file);
+        compress_file(file);
+
+        record->data_off = align_up(off, ARCHIVE_ALIGN);
+        record->size = file->st.st_size;
+        write_at(fd, file->data, record->size, record->data_off);
+        off = record->data_off + record->size;
+        record->ino = file->st.st_ino;
+        record->mtime = file->st.st_mtim.tv_sec;
+        record->mtime_nsec = file->st.st_mtim.tv_nsec;
+        record->header_len = render_header(file, record->size, "", file->header);
+        write_at(fd, file->header, record->header_len, record->header_off);
+        if (file->gzip) {
+            record->gzip_off = align_up(off, ARCHIVE_ALIGN);
+            record->gzip_size = file->gzip_size;
+            write_at(fd, file->gzip, record->gzip_size, record->gzip_off);
+            off = record->gzip_off + record->gzip_size;
+            record->gzip_header_len = render_header(file, record->gzip_size, "-gzip", file->gzip_header);
+            write_at(fd, file->gzip_header, record->gzip_header_len, record->gzip_header_off);
+            gzipped++;
+        }
+        write_at(fd, file->url, record->url_len + 1, record->url_off);
+        packed += record->size;
+        if (options.verbose)
+            printf("%s %lld%s\n", file->url, (long long)record->size, file->gzip ? " +gzip" : "");
+
+        free(file->data);
+        free(file->gzip);
+    }
+    header.size = off;
+
+    write_at(fd, seeds, header.nbuckets * sizeof(uint32_t), header.seeds_off);
+    write_at(fd, slots, header.nslots * sizeof(uint32_t), header.slots_off);
+    write_at(fd, records, (uint64_t)nfiles * sizeof(archive_file_t), header.files_off);
+    write_at(fd, &header, sizeof(header), 0);
+    if (ftruncate(fd, header.size) < 0 || fsync(fd) < 0 || close(fd) < 0 || rename(tmp_path, out_path) < 0) {
+        perror(out_path);
+        unlink(tmp_path);
+        return 1;
+    }
+
+    printf("%s: %d files, %lu bytes, %lu gzip copies, %u slots, %llu bytes\n", out_path, nfiles,
+            packed, gzipped, header.nslots, (unsigned long long)header.size);
+    return 0;
+}
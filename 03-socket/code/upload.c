@@ -0,0 +1,362 @@
+#include "cache.h"
+#include "config.h"
+#include "http.h"
+#include "upload.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+int wants_upload(conn_t *conn)
+{
+    http_parser_t *parser = &conn->parser;
+    return config.max_upload > 0 && (view_equals(conn->request, parser->method, "PUT")
+            || view_equals(conn->request, parser->method, "POST"));
+}
+
+int start_upload(conn_t *conn, const char *url, int chunked, off_t length)
+{
+    static unsigned long uploads;
+
+    // the docroot itself is a directory too
+    const char *slash = strrchr(url, '/');
+    if (slash[1] == '\0')
+        return CONFLICT;
+    // nor may one land on another's hidden file
+    if (is_upload_part(url))
+        return FORBIDDEN;
+
+    upload_t *up = calloc(1, sizeof(upload_t));
+    if (up == NULL)
+        return INTERNAL_SERVER_ERROR;
+    up->fd = -1;
+    up->pipe[0] = up->pipe[1] = -1;
+    snprintf(up->url, sizeof(up->url), "%s", url);
+    snprintf(up->path, sizeof(up->path), ".%s", url);
+
+    struct stat st;
+    int exists = stat(up->path, &st) == 0;
+    if (exists && S_ISDIR(st.st_mode)) {
+        free(up);
+        return CONFLICT;
+    }
+    up->created = !exists;
+
+    // hidden and unique, next to the path so the rename stays in the directory
+    snprintf(up->tmp, sizeof(up->tmp), ".%.*s.%s.%lu" UPLOAD_PART_SUFFIX, (int)(slash + 1 - url), url, slash + 1,
+            __atomic_add_fetch(&uploads, 1, __ATOMIC_RELAXED));
+    up->fd = open(up->tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (up->fd < 0) {
+        int status = errno == ENOENT || errno == ENOTDIR ? NOT_FOUND : errno == EACCES ? FORBIDDEN : INTERNAL_SERVER_ERROR;
+        free(up);
+        return status;
+    }
+
+    // a body framed by HTTP/2 may come without a length, left stays
+    // negative then
+    up->chunked = chunked;
+    if (chunked) {
+        up->state = CHUNK_SIZE;
+    } else {
+        up->state = length != 0 ? BODY_DATA : BODY_DONE;
+        up->left = length;
+    }
+    conn->upload = up;
+    return 0;
+}
+
+void free_upload(upload_t *up)
+{
+    if (up->fd >= 0)
+        close(up->fd);
+    if (up->pipe[0] >= 0) {
+        close(up->pipe[0]);
+        close(up->pipe[1]);
+    }
+    if (up->tmp[0])
+        unlink(up->tmp);
+    free(up);
+}
+
+static int fail(upload_t *up, int status)
+{
+    up->status = status;
+    return -1;
+}
+
+// n bytes of data are in the file
+static void stored(upload_t *up, off_t n)
+{
+    up->size += n;
+    up->left -= n;
+    if (up->left == 0)
+        up->state = up->chunked ? CHUNK_DATA_CR : BODY_DONE;
+}
+
+static int store(upload_t *up, const char *buf, int len)
+{
+    for (int done = 0; done < len; ) {
+        ssize_t n = write(up->fd, buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return fail(up, INTERNAL_SERVER_ERROR);
+        done += n;
+    }
+    stored(up, len);
+    return 0;
+}
+
+static int hex_digit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// the size line of a chunk is complete, a chunk of 0 is the last one
+static void size_line_done(upload_t *up)
+{
+    if (up->chunk == 0) {
+        up->state = TRAILER_START;
+    } else {
+        up->state = BODY_DATA;
+        up->left = up->chunk;
+        up->line = 0;
+    }
+}
+
+// run the chunked framing over len bytes of the body and store the data
+// among them, with framing_only set stop where data starts instead. Returns
+// the bytes used, fewer than len once the body is complete, or -1 with the
+// status set if the body is malformed, too large or cannot be stored.
+static int consume(upload_t *up, const char *buf, int len, int framing_only)
+{
+    int i = 0;
+
+    while (i < len && up->state != BODY_DONE) {
+        if (up->state == BODY_DATA) {
+            if (framing_only)
+                break;
+            int n = up->left < len - i ? up->left : len - i;
+            if (store(up, buf + i, n) < 0)
+                return -1;
+            i += n;
+            continue;
+        }
+
+        // the sizes are bounded, the lines and trailers around them too
+        if (++up->line > UPLOAD_MAX_LINE)
+            return fail(up, BAD_REQUEST);
+        char c = buf[i++];
+        int d;
+
+        switch (up->state) {
+            case CHUNK_SIZE:
+                if ((d = hex_digit(c)) >= 0) {
+                    off_t room = config.max_upload - up->size;
+                    if (up->chunk > room / 16 || up->chunk * 16 + d > room)
+                        return fail(up, PAYLOAD_TOO_LARGE);
+                    up->chunk = up->chunk * 16 + d;
+                    up->digits++;
+                } else if (up->digits == 0) {
+                    return fail(up, BAD_REQUEST);
+                } else if (c == '\n') {
+                    size_line_done(up);
+                } else if (c == ';' || c == ' ' || c == '\t' || c == '\r') {
+                    up->state = CHUNK_EXT;
+                } else {
+                    return fail(up, BAD_REQUEST);
+                }
+                break;
+            case CHUNK_EXT:
+                if (c == '\n')
+                    size_line_done(up);
+                break;
+            case CHUNK_DATA_CR:
+            case CHUNK_DATA_LF:
+                if (c == '\r' && up->state == CHUNK_DATA_CR) {
+                    up->state = CHUNK_DATA_LF;
+                } else if (c == '\n') {
+                    up->state = CHUNK_SIZE;
+                    up->chunk = 0;
+                    up->digits = 0;
+                } else {
+                    return fail(up, BAD_REQUEST);
+                }
+                break;
+            case TRAILER_START:
+                if (c == '\n')
+                    up->state = BODY_DONE;
+                else if (c != '\r')
+                    up->state = TRAILER_LINE;
+                break;
+            case TRAILER_LINE:
+                if (c == '\n')
+                    up->state = TRAILER_START;
+                break;
+        }
+    }
+    return i;
+}
+
+// move data straight from the socket into the file, same return convention
+// as conn_read
+static ssize_t splice_data(upload_t *up, int sock)
+{
+    if (up->pipe[0] < 0) {
+        if (pipe2(up->pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+            up->pipe[0] = up->pipe[1] = -1;
+            errno = EIO;
+            return fail(up, INTERNAL_SERVER_ERROR);
+        }
+        // a bigger pipe takes more per call, the default will do otherwise
+        fcntl(up->pipe[1], F_SETPIPE_SZ, UPLOAD_PIPE_SIZE);
+        up->pipe_size = fcntl(up->pipe[1], F_GETPIPE_SZ);
+        if (up->pipe_size <= 0)
+            up->pipe_size = 64 << 10;
+    }
+
+    size_t count = up->left < up->pipe_size ? up->left : up->pipe_size;
+    ssize_t n = splice(sock, NULL, up->pipe[1], NULL, count, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n <= 0)
+        return n;
+
+    // the pipe is emptied every time, a write to a file does not block
+    for (ssize_t moved = 0; moved < n; ) {
+        ssize_t m = splice(up->pipe[0], NULL, up->fd, NULL, n - moved, SPLICE_F_MOVE);
+        if (m < 0 && errno == EINTR)
+            continue;
+        if (m <= 0) {
+            errno = EIO;
+            return fail(up, INTERNAL_SERVER_ERROR);
+        }
+        moved += m;
+    }
+    stored(up, n);
+    return n;
+}
+
+// read data into the body buffer and write it out, same return convention as
+// conn_read
+static ssize_t copy_data(upload_t *up, conn_t *conn)
+{
+    if (conn->buf == NULL && (conn->buf = malloc(config.buffer_size)) == NULL) {
+        errno = ENOMEM;
+        return fail(up, INTERNAL_SERVER_ERROR);
+    }
+
+    int count = up->left < config.buffer_size ? up->left : config.buffer_size;
+    int n = conn_read(conn, conn->buf, count);
+    if (n <= 0)
+        return n;
+    if (store(up, conn->buf, n) < 0) {
+        errno = EIO;
+        return -1;
+    }
+    return n;
+}
+
+// take the framing in front of the next data off the socket, peeking first
+// so no byte past the framing is read: the data is spliced, and what follows
+// the body belongs to the next request
+static ssize_t read_framing(upload_t *up, conn_t *conn)
+{
+    char buf[UPLOAD_PEEK_SIZE];
+    int n = conn_peek(conn, buf, sizeof(buf));
+    if (n <= 0)
+        return n;
+
+    int used = consume(up, buf, n, 1);
+    if (used < 0) {
+        errno = EPROTO;
+        return -1;
+    }
+    return conn_read(conn, buf, used);
+}
+
+int read_upload(event_loop_t *loop, conn_t *conn)
+{
+    upload_t *up = conn->upload;
+
+    // the client waits for the interim response before sending the body
+    while (conn->response_sent < conn->response_len) {
+        int n = conn_write(conn, conn->response + conn->response_sent, conn->response_len - conn->response_sent);
+        if (n < 0 && errno == EAGAIN)
+            return 0;
+        if (n < 0)
+            return -1;
+        conn_sent(loop, conn, n);
+        conn->response_sent += n;
+    }
+
+    // body bytes that came along with the header block
+    if (conn->request_end < conn->request_len) {
+        int n = consume(up, conn->request + conn->request_end, conn->request_len - conn->request_end, 0);
+        if (n > 0)
+            conn->request_end += n;
+    }
+
+    while (up->state != BODY_DONE && up->status == 0) {
+        ssize_t n;
+        if (up->state != BODY_DATA)
+            n = read_framing(up, conn);
+        else if (conn->ssl)
+            n = copy_data(up, conn);
+        else
+            n = splice_data(up, conn->fd);
+
+        if (up->status)
+            break;
+        if (n < 0 && errno == EAGAIN)
+            return 0;
+        if (n <= 0)
+            return -1;
+        conn_received(loop, conn, n);
+    }
+
+    finish_upload(conn);
+    return 1;
+}
+
+int upload_data(upload_t *up, const char *buf, int len)
+{
+    // a Content-Length, if there was one, has to match the data
+    if (up->left >= 0 && len > up->left)
+        return fail(up, BAD_REQUEST);
+    if (up->size + len > config.max_upload)
+        return fail(up, PAYLOAD_TOO_LARGE);
+    return store(up, buf, len);
+}
+
+void finish_upload(conn_t *conn)
+{
+    upload_t *up = conn->upload;
+
+    // the body ended short of its Content-Length
+    if (up->status == 0 && up->left > 0)
+        up->status = BAD_REQUEST;
+    if (up->status == 0) {
+        if (rename(up->tmp, up->path) == 0) {
+            up->tmp[0] = '\0';
+            // the cache hears of it through inotify, a client that reads
+            // back right away should not have to wait for that
+            cache_invalidate(up->url, 0);
+        } else {
+            up->status = INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    int status = up->status ? up->status : up->created ? CREATED : NO_CONTENT;
+    free_upload(up);
+    conn->upload = NULL;
+    handle_upload_done(conn, status);
+}
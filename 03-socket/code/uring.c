@@ -0,0 +1,601 @@
+#include "admission.h"
+#include "config.h"
+#include "http.h"
+#include "uring.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// what a completion is for, kept in the low bits of user_data next to the
+// pointer to the connection or listener. A user_data of 0 is never looked at.
+enum uring_op {
+    OP_ACCEPT = 1,                      // multishot accept on a listener
+    OP_POLL,                            // multishot poll driving a TLS or uploading connection
+    OP_RECV,                            // request bytes, usually in a provided buffer
+    OP_LINK,                            // a request in the middle of a linked chain
+    OP_SEND,                            // the last send of a piece of the response
+    OP_HANDOFF,                         // the eventfd of the handoff stack was written
+};
+
+#define OP_MASK 7
+
+// features relied upon, all there since 5.19 together with multishot accept
+// and provided buffer rings, which the setup cannot detect by itself
+#define URING_FEATURES (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP \
+        | IORING_FEAT_FAST_POLL | IORING_FEAT_EXT_ARG)
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags,
+        void *arg, size_t size)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, size);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void recycle_recv_buf(uring_t *ring, int bid)
+{
+    struct io_uring_buf *buf = &ring->recv_ring->bufs[ring->recv_tail & (URING_RECV_BUFS - 1)];
+    buf->addr = (unsigned long)(ring->recv_bufs + bid * URING_RECV_BUF_SIZE);
+    buf->len = URING_RECV_BUF_SIZE;
+    buf->bid = bid;
+    ring->recv_tail++;
+    __atomic_store_n(&ring->recv_ring->tail, ring->recv_tail, __ATOMIC_RELEASE);
+}
+
+// receives pick a buffer from a ring shared with the kernel, so connections
+// waiting for a request do not each need one pinned
+static int setup_recv_bufs(uring_t *ring)
+{
+    size_t ring_size = URING_RECV_BUFS * sizeof(struct io_uring_buf);
+    ring->recv_ring = mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring->recv_bufs = malloc(URING_RECV_BUFS * URING_RECV_BUF_SIZE);
+    if (ring->recv_ring == MAP_FAILED || ring->recv_bufs == NULL)
+        return -1;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)ring->recv_ring;
+    reg.ring_entries = URING_RECV_BUFS;
+    reg.bgid = URING_RECV_GROUP;
+    if (io_uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+        return -1;
+
+    for (int i = 0; i < URING_RECV_BUFS; i++)
+        recycle_recv_buf(ring, i);
+    return 0;
+}
+
+// body buffers and file slots are registered once so reads skip the page
+// pinning and file lookup. Running without them only costs speed.
+static void setup_fixed(uring_t *ring)
+{
+    size_t size = (size_t)URING_FIXED_BUFS * config.buffer_size;
+    ring->fixed_bufs = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring->fixed_bufs != MAP_FAILED) {
+        struct iovec iov[URING_FIXED_BUFS];
+        for (int i = 0; i < URING_FIXED_BUFS; i++) {
+            iov[i].iov_base = ring->fixed_bufs + (size_t)i * config.buffer_size;
+            iov[i].iov_len = config.buffer_size;
+        }
+        if (io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov, URING_FIXED_BUFS) == 0) {
+            for (int i = 0; i < URING_FIXED_BUFS; i++)
+                ring->free_bufs[ring->nfree_bufs++] = i;
+        } else {
+            perror("io_uring register buffers failed");
+        }
+    }
+
+    int fds[URING_FILES];
+    memset(fds, -1, sizeof(fds));
+    if (io_uring_register(ring->fd, IORING_REGISTER_FILES, fds, URING_FILES) == 0) {
+        for (int i = 0; i < URING_FILES; i++)
+            ring->free_files[ring->nfree_files++] = i;
+    } else {
+        perror("io_uring register files failed");
+    }
+}
+
+int init_uring(event_loop_t *loop)
+{
+    uring_t *ring = calloc(1, sizeof(uring_t));
+    if (ring == NULL)
+        return -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = URING_ENTRIES * 4;
+    ring->fd = io_uring_setup(URING_ENTRIES, &params);
+    if (ring->fd < 0) {
+        perror("io_uring_setup failed");
+        free(ring);
+        return -1;
+    }
+    if ((params.features & URING_FEATURES) != URING_FEATURES)
+        goto fail;
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    char *rings = mmap(NULL, sq_size > cq_size ? sq_size : cq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (rings == MAP_FAILED || ring->sqes == MAP_FAILED)
+        goto fail;
+
+    ring->sq_head = (unsigned *)(rings + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(rings + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(rings + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+    ring->tail = ring->submitted = *ring->sq_tail;
+    // sqe i always sits in slot i of the array
+    unsigned *array = (unsigned *)(rings + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++)
+        array[i] = i;
+
+    ring->cq_head = (unsigned *)(rings + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(rings + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(rings + params.cq_off.cqes);
+
+    if (setup_recv_bufs(ring) < 0)
+        goto fail;
+    setup_fixed(ring);
+
+    loop->ring = ring;
+    return 0;
+
+fail:
+    // a kernel too old for multishot accept or buffer rings, use epoll
+    close(ring->fd);
+    free(ring->recv_bufs);
+    free(ring);
+    return -1;
+}
+
+// hand the queued sqes to the kernel and wait for at least wait completions,
+// at most until timeout if one is given
+static int submit(uring_t *ring, unsigned wait, struct __kernel_timespec *timeout)
+{
+    __atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+
+    struct io_uring_getevents_arg arg;
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    if (timeout) {
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (unsigned long)timeout;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    int n = io_uring_enter(ring->fd, ring->tail - ring->submitted, wait, flags,
+            timeout ? &arg : NULL, timeout ? sizeof(arg) : 0);
+    stat_add(ring->enters, 1);
+    if (n > 0)
+        ring->submitted += n;
+    return n;
+}
+
+static struct io_uring_sqe *get_sqe(uring_t *ring)
+{
+    // the queue is full, push it to the kernel to make room
+    while (ring->tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+        submit(ring, 0, NULL);
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->tail++ & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// queue a request on the connection, it is counted until its completion
+static struct io_uring_sqe *conn_sqe(event_loop_t *loop, conn_t *conn, int opcode, int op)
+{
+    struct io_uring_sqe *sqe = get_sqe(loop->ring);
+    sqe->opcode = opcode;
+    sqe->fd = conn->fd;
+    sqe->user_data = (uintptr_t)conn | op;
+    conn->inflight++;
+    return sqe;
+}
+
+static void arm_accept(event_loop_t *loop, listener_t *listener)
+{
+    struct io_uring_sqe *sqe = get_sqe(loop->ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = (uintptr_t)listener | OP_ACCEPT;
+}
+
+// OpenSSL owns the socket of a TLS connection, so the ring only reports
+// readiness and the connection goes through the same state machine as with
+// epoll
+static void arm_poll(event_loop_t *loop, conn_t *conn)
+{
+    struct io_uring_sqe *sqe = conn_sqe(loop, conn, IORING_OP_POLL_ADD, OP_POLL);
+    sqe->poll32_events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    sqe->len = IORING_POLL_ADD_MULTI;
+}
+
+// wait for the handshake pool to hand over connections
+static void arm_handoff(event_loop_t *loop)
+{
+    struct io_uring_sqe *sqe = get_sqe(loop->ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loop->handoff.fd;
+    sqe->addr = (unsigned long)&loop->handoff.count;
+    sqe->len = sizeof(loop->handoff.count);
+    sqe->user_data = (uintptr_t)&loop->handoff | OP_HANDOFF;
+}
+
+// read more of the request, into whichever provided buffer the kernel picks
+// or, when they have run out, straight into the request buffer. The length
+// is capped so pipelined requests never outrun the request buffer.
+static void arm_recv(event_loop_t *loop, conn_t *conn, int provided)
+{
+    struct io_uring_sqe *sqe = conn_sqe(loop, conn, IORING_OP_RECV, OP_RECV);
+    sqe->len = REQUEST_BUF_SIZE - conn->request_len;
+    if (provided) {
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = URING_RECV_GROUP;
+    } else {
+        sqe->addr = (unsigned long)(conn->request + conn->request_len);
+    }
+}
+
+// return the registered buffer and file slot of a finished body
+static void put_fixed(uring_t *ring, conn_t *conn)
+{
+    if (conn->fixed_buf >= 0)
+        ring->free_bufs[ring->nfree_bufs++] = conn->fixed_buf;
+    conn->fixed_buf = -1;
+    // the slot keeps a reference to the file until it is reused
+    if (conn->fixed_file >= 0)
+        ring->free_files[ring->nfree_files++] = conn->fixed_file;
+    conn->fixed_file = -1;
+}
+
+// send what is left of the response headers together with iov, as one
+// sendmsg that either sends everything or fails
+static void queue_send(event_loop_t *loop, conn_t *conn, struct iovec *body)
+{
+    int n = 0;
+    if (conn->response_sent < conn->response_len) {
+        conn->iov[n].iov_base = conn->response + conn->response_sent;
+        conn->iov[n++].iov_len = conn->response_len - conn->response_sent;
+        conn->response_sent = conn->response_len;
+    }
+    if (body && body->iov_len > 0)
+        conn->iov[n++] = *body;
+
+    memset(&conn->msg, 0, sizeof(conn->msg));
+    conn->msg.msg_iov = conn->iov;
+    conn->msg.msg_iovlen = n;
+
+    struct io_uring_sqe *sqe = conn_sqe(loop, conn, IORING_OP_SENDMSG, OP_SEND);
+    sqe->addr = (unsigned long)&conn->msg;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+}
+
+// read the next chunk of the body file and send it, linked so both go to the
+// kernel at once and the send only starts after a complete read
+static void queue_file_chunk(event_loop_t *loop, conn_t *conn)
+{
+    uring_t *ring = loop->ring;
+    struct io_uring_sqe *sqe;
+
+    if (conn->fixed_buf < 0 && ring->nfree_bufs > 0)
+        conn->fixed_buf = ring->free_bufs[--ring->nfree_bufs];
+    if (conn->fixed_buf < 0 && conn->buf == NULL && (conn->buf = malloc(config.buffer_size)) == NULL) {
+        close_conn(loop, conn);
+        return;
+    }
+    char *buf = conn->fixed_buf >= 0 ? ring->fixed_bufs + (size_t)conn->fixed_buf * config.buffer_size : conn->buf;
+
+    // the file goes into a registered slot before its first read
+    if (conn->fixed_file < 0 && ring->nfree_files > 0) {
+        conn->fixed_file = ring->free_files[--ring->nfree_files];
+        sqe = conn_sqe(loop, conn, IORING_OP_FILES_UPDATE, OP_LINK);
+        sqe->fd = -1;
+        sqe->addr = (unsigned long)&conn->file_fd;
+        sqe->len = 1;
+        sqe->off = conn->fixed_file;
+        sqe->flags = IOSQE_IO_LINK;
+    }
+
+    int len = conn->file_left < config.buffer_size ? conn->file_left : config.buffer_size;
+    sqe = conn_sqe(loop, conn, conn->fixed_buf >= 0 ? IORING_OP_READ_FIXED : IORING_OP_READ, OP_LINK);
+    sqe->fd = conn->file_fd;
+    if (conn->fixed_file >= 0) {
+        sqe->fd = conn->fixed_file;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    sqe->flags |= IOSQE_IO_LINK;
+    sqe->addr = (unsigned long)buf;
+    sqe->len = len;
+    sqe->off = conn->file_offset;
+    if (conn->fixed_buf >= 0)
+        sqe->buf_index = conn->fixed_buf;
+
+    // a short read fails the link and cancels the send
+    struct iovec body = { buf, len };
+    conn->buf_len = len;
+    queue_send(loop, conn, &body);
+}
+
+// send the prepared response, the body of a plaintext connection is read
+// and sent through the ring too
+static void send_response(event_loop_t *loop, conn_t *conn)
+{
+    if (conn->body == NULL && conn->file_left > 0) {
+        queue_file_chunk(loop, conn);
+        return;
+    }
+
+    struct iovec body = { (char *)conn->body + conn->body_sent, conn->body_len - conn->body_sent };
+    conn->body_sent = conn->body_len;
+    queue_send(loop, conn, conn->body ? &body : NULL);
+}
+
+// answer the requests in the buffer, or wait for more of one
+// an upload body is spliced on readiness like TLS, which the connection keeps
+// doing from then on
+static void serve_requests(event_loop_t *loop, conn_t *conn)
+{
+    if (!prepare_response(loop, conn)) {
+        arm_recv(loop, conn, 1);
+    } else if (conn->upload) {
+        conn->state = CONN_READ_BODY;
+        arm_poll(loop, conn);
+        process_conn(loop, conn);
+    } else {
+        send_response(loop, conn);
+    }
+}
+
+static void response_done(event_loop_t *loop, conn_t *conn)
+{
+    put_fixed(loop->ring, conn);
+    if (next_range_part(conn)) {
+        send_response(loop, conn);
+        return;
+    }
+
+    finish_response(loop, conn);
+    if (conn->state == CONN_CLOSE)
+        close_conn(loop, conn);
+    else
+        serve_requests(loop, conn);
+}
+
+static void on_accept(event_loop_t *loop, listener_t *listener, struct io_uring_cqe *cqe)
+{
+    // the kernel stops a multishot accept on errors, start it again
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        arm_accept(loop, listener);
+    if (cqe->res < 0) {
+        if (cqe->res != -EAGAIN && cqe->res != -ECONNABORTED && cqe->res != -EINTR) {
+            errno = -cqe->res;
+            perror("Accept failed");
+        }
+        return;
+    }
+
+    // the peer address is only wanted for logging and the per-client cap
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int have_addr = (config.verbose || config.access_log || config.max_conns_per_ip > 0) && getpeername(cqe->res, (struct sockaddr *)&addr, &len) == 0;
+
+    conn_t *conn = new_conn(loop, listener, cqe->res, have_addr ? &addr : NULL);
+    if (conn == NULL) {
+        close(cqe->res);
+        return;
+    }
+
+    if (conn->ssl)
+        arm_poll(loop, conn);
+    else
+        arm_recv(loop, conn, 1);
+}
+
+// the read already drained the eventfd, a push after the stack is taken
+// completes the next one
+static void on_handoff(event_loop_t *loop)
+{
+    conn_t *conn = take_handoffs(loop);
+    arm_handoff(loop);
+
+    while (conn) {
+        conn_t *next = conn->handoff_next;
+        adopt_conn(loop, conn);
+        arm_poll(loop, conn);
+        process_conn(loop, conn);
+        conn = next;
+    }
+}
+
+static void on_recv(event_loop_t *loop, conn_t *conn, struct io_uring_cqe *cqe)
+{
+    int n = cqe->res;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        // the request has to be contiguous for the parser, copy it over
+        int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (n > 0)
+            memcpy(conn->request + conn->request_len, loop->ring->recv_bufs + bid * URING_RECV_BUF_SIZE, n);
+        recycle_recv_buf(loop->ring, bid);
+    }
+
+    if (n == -ENOBUFS) {
+        arm_recv(loop, conn, 0);
+        return;
+    }
+    if (n <= 0) {
+        close_conn(loop, conn);
+        return;
+    }
+
+    stop_idle(loop, conn);
+    conn->request_len += n;
+    conn->request[conn->request_len] = '\0';
+    serve_requests(loop, conn);
+}
+
+static void on_send(event_loop_t *loop, conn_t *conn, struct io_uring_cqe *cqe)
+{
+    size_t expected = 0;
+    for (int i = 0; i < conn->msg.msg_iovlen; i++)
+        expected += conn->iov[i].iov_len;
+    if (cqe->res < 0 || (size_t)cqe->res != expected) {
+        close_conn(loop, conn);
+        return;
+    }
+    conn_sent(loop, conn, cqe->res);
+
+    // a chunk of the file went out
+    if (conn->buf_len > 0) {
+        conn->file_offset += conn->buf_len;
+        conn->file_left -= conn->buf_len;
+        conn->buf_len = 0;
+        if (conn->file_left > 0) {
+            queue_file_chunk(loop, conn);
+            return;
+        }
+    }
+
+    response_done(loop, conn);
+}
+
+static void handle_completion(event_loop_t *loop, struct io_uring_cqe *cqe)
+{
+    int op = cqe->user_data & OP_MASK;
+    void *ptr = (void *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+
+    if (ptr == NULL)
+        return;
+    if (op == OP_ACCEPT) {
+        on_accept(loop, ptr, cqe);
+        return;
+    }
+    if (op == OP_HANDOFF) {
+        on_handoff(loop);
+        return;
+    }
+
+    conn_t *conn = ptr;
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        conn->inflight--;
+
+    // being torn down, wait for the last completion
+    if (conn->closing) {
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+            recycle_recv_buf(loop->ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (conn->inflight == 0)
+            close_conn(loop, conn);
+        return;
+    }
+
+    switch (op) {
+        case OP_POLL:
+            if (!(cqe->flags & IORING_CQE_F_MORE))
+                arm_poll(loop, conn);
+            process_conn(loop, conn);
+            break;
+        case OP_RECV:
+            on_recv(loop, conn, cqe);
+            break;
+        case OP_SEND:
+            on_send(loop, conn, cqe);
+            break;
+        case OP_LINK:
+            // failures also show up on the send ending the chain
+            break;
+    }
+}
+
+// stop everything in flight on the connection, it is freed by close_conn()
+// once the last completion is in
+void cancel_conn_io(event_loop_t *loop, conn_t *conn)
+{
+    if (conn->closing)
+        return;
+    conn->closing = 1;
+
+    // pending receives complete right away on a shut down socket
+    shutdown(conn->fd, SHUT_RDWR);
+
+    struct io_uring_sqe *sqe = get_sqe(loop->ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = conn->fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+}
+
+void release_conn_io(event_loop_t *loop, conn_t *conn)
+{
+    put_fixed(loop->ring, conn);
+}
+
+// the multishot accept takes connections off the accept queue as they come
+// in, so for admission control those waiting are the accept completions of
+// the turn, counted up front
+static void count_accepts(event_loop_t *loop)
+{
+    uring_t *ring = loop->ring;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < loop->nlisteners; i++)
+        loop->listeners[i].completed = 0;
+    for (unsigned head = *ring->cq_head; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        if ((cqe->user_data & OP_MASK) == OP_ACCEPT && cqe->res >= 0)
+            ((listener_t *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK))->completed++;
+    }
+}
+
+void run_uring_loop(event_loop_t *loop)
+{
+    uring_t *ring = loop->ring;
+
+    for (int i = 0; i < loop->nlisteners; i++)
+        arm_accept(loop, &loop->listeners[i]);
+    if (loop->handoff.type == EV_HANDOFF)
+        arm_handoff(loop);
+
+    while (1) {
+        struct __kernel_timespec timeout = { 1, 0 };
+        int n = submit(ring, 1, loop->timers.armed ? &timeout : NULL);
+        if (n < 0 && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN) {
+            perror("io_uring_enter failed");
+            exit(1);
+        }
+
+        start_turn(loop);
+        if (config.shed_queue > 0)
+            count_accepts(loop);
+        unsigned head = *ring->cq_head;
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+            __atomic_store_n(ring->cq_head, ++head, __ATOMIC_RELEASE);
+            stat_add(ring->completions, 1);
+            handle_completion(loop, &cqe);
+        }
+        end_turn(loop);
+
+        expire_conns(loop);
+    }
+}
@@ -0,0 +1,199 @@
+#include "uring.h"
+#include "worker.h"
+
+#include <openssl/err.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+worker_t *workers;
+int nworkers;
+worker_t *handshakers;
+int nhandshakers;
+
+static void *worker_thread(void *arg)
+{
+    worker_t *worker = arg;
+
+    if (worker->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+            fprintf(stderr, "worker %d: pin to cpu %d failed\n", worker->id, worker->cpu);
+    }
+
+    run_event_loop(&worker->loop);
+
+    return NULL;
+}
+
+// pick the n-th cpu this process is allowed to run on
+static int nth_cpu(cpu_set_t *set, int n)
+{
+    int count = CPU_COUNT(set);
+    if (count == 0)
+        return -1;
+    n %= count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, set) && n-- == 0)
+            return cpu;
+    }
+    return -1;
+}
+
+// every worker opens its own SO_REUSEPORT listeners, so the kernel spreads
+// incoming connections across the event loops
+void start_workers(int n, int pin_cpus)
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+        CPU_ZERO(&set);
+
+    // the metrics of each worker are cache line aligned
+    nworkers = n;
+    workers = aligned_alloc(CACHE_LINE, n * sizeof(worker_t));
+    memset(workers, 0, n * sizeof(worker_t));
+
+    for (int i = 0; i < n; i++) {
+        worker_t *worker = &workers[i];
+        worker->id = i;
+        worker->cpu = pin_cpus ? nth_cpu(&set, i) : -1;
+        init_event_loop(&worker->loop);
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i])) {
+            perror("creat worker thread error!\n");
+            exit(1);
+        }
+    }
+}
+
+// TLS handshakes run on threads of their own, so the private key operations
+// of a burst of new clients never sit between a worker and the responses it
+// is sending. They are plain event loops that only accept on the https port.
+void start_handshake_pool(int n)
+{
+    nhandshakers = n;
+    handshakers = aligned_alloc(CACHE_LINE, n * sizeof(worker_t));
+    memset(handshakers, 0, n * sizeof(worker_t));
+
+    for (int i = 0; i < n; i++) {
+        worker_t *worker = &handshakers[i];
+        worker->id = i;
+        worker->cpu = -1;
+        init_handshake_loop(&worker->loop);
+        if (pthread_create(&worker->thread, NULL, worker_thread, worker)) {
+            perror("creat handshake thread error!\n");
+            exit(1);
+        }
+    }
+}
+
+// the worker with the fewest connections, those on its way to it included
+static event_loop_t *least_loaded_worker()
+{
+    event_loop_t *best = NULL;
+    long best_load = 0;
+
+    for (int i = 0; i < nworkers; i++) {
+        event_loop_t *loop = &workers[i].loop;
+        long load = __atomic_load_n(&loop->nconns, __ATOMIC_RELAXED) +
+                __atomic_load_n(&loop->handoff.depth, __ATOMIC_RELAXED);
+        if (best == NULL || load < best_load) {
+            best = loop;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+// give a connection whose handshake just finished to a worker, it is no
+// longer touched by the handshake thread afterwards
+void hand_off(event_loop_t *loop, conn_t *conn)
+{
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    cancel_timer(&loop->timers, &conn->timer);
+    stat_add(loop->nconns, -1);
+    // the error queue is per thread, see close_conn()
+    ERR_clear_error();
+
+    event_loop_t *worker = least_loaded_worker();
+    handoff_t *handoff = &worker->handoff;
+    __atomic_add_fetch(&handoff->depth, 1, __ATOMIC_RELAXED);
+
+    conn_t *head = __atomic_load_n(&handoff->head, __ATOMIC_RELAXED);
+    do {
+        conn->handoff_next = head;
+    } while (!__atomic_compare_exchange_n(&handoff->head, &head, conn, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // a non-empty stack already has a wakeup on its way
+    if (head == NULL) {
+        unsigned long long one = 1;
+        if (write(handoff->fd, &one, sizeof(one)) < 0)
+            perror("write eventfd failed");
+    }
+}
+
+// print how many connections each worker has taken, to spot imbalance
+void dump_worker_stats()
+{
+    unsigned long total = 0;
+
+    fprintf(stderr, "worker  cpu  accepted    active  ktls        userspace-tls\n");
+    for (int i = 0; i < nworkers; i++) {
+        event_loop_t *loop = &workers[i].loop;
+        unsigned long accepted = __atomic_load_n(&loop->accepted, __ATOMIC_RELAXED);
+        int active = __atomic_load_n(&loop->nconns, __ATOMIC_RELAXED);
+        unsigned long ktls = __atomic_load_n(&loop->ktls_conns, __ATOMIC_RELAXED);
+        unsigned long user_tls = __atomic_load_n(&loop->user_tls_conns, __ATOMIC_RELAXED);
+        fprintf(stderr, "%-7d %-4d %-11lu %-7d %-11lu %lu\n", i, workers[i].cpu, accepted, active,
+                ktls, user_tls);
+        total += accepted;
+    }
+    fprintf(stderr, "total        %lu\n", total);
+
+    fprintf(stderr, "worker  full-hs     resumed-hs  avg-full-us avg-resumed-us\n");
+    for (int i = 0; i < nworkers; i++) {
+        event_loop_t *loop = &workers[i].loop;
+        unsigned long full = __atomic_load_n(&loop->full_handshakes, __ATOMIC_RELAXED);
+        unsigned long resumed = __atomic_load_n(&loop->resumed_handshakes, __ATOMIC_RELAXED);
+        unsigned long full_usec = __atomic_load_n(&loop->full_handshake_usec, __ATOMIC_RELAXED);
+        unsigned long resumed_usec = __atomic_load_n(&loop->resumed_handshake_usec, __ATOMIC_RELAXED);
+        fprintf(stderr, "%-7d %-11lu %-11lu %-11lu %lu\n", i, full, resumed,
+                full ? full_usec / full : 0, resumed ? resumed_usec / resumed : 0);
+    }
+    for (int i = 0; i < nhandshakers; i++) {
+        event_loop_t *loop = &handshakers[i].loop;
+        unsigned long full = __atomic_load_n(&loop->full_handshakes, __ATOMIC_RELAXED);
+        unsigned long resumed = __atomic_load_n(&loop->resumed_handshakes, __ATOMIC_RELAXED);
+        unsigned long full_usec = __atomic_load_n(&loop->full_handshake_usec, __ATOMIC_RELAXED);
+        unsigned long resumed_usec = __atomic_load_n(&loop->resumed_handshake_usec, __ATOMIC_RELAXED);
+        int active = __atomic_load_n(&loop->nconns, __ATOMIC_RELAXED);
+        fprintf(stderr, "hs-%-4d %-11lu %-11lu %-11lu %-14lu %d handshaking\n", i, full, resumed,
+                full ? full_usec / full : 0, resumed ? resumed_usec / resumed : 0, active);
+    }
+
+    if (nworkers > 0 && workers[0].loop.log) {
+        unsigned long dropped = 0;
+        for (int i = 0; i < nworkers; i++)
+            dropped += __atomic_load_n(&workers[i].loop.log->dropped, __ATOMIC_RELAXED);
+        fprintf(stderr, "access log: %lu records dropped\n", dropped);
+    }
+
+    if (nworkers == 0 || workers[0].loop.ring == NULL)
+        return;
+    fprintf(stderr, "worker  ring-enters completions\n");
+    for (int i = 0; i < nworkers; i++) {
+        uring_t *ring = workers[i].loop.ring;
+        if (ring == NULL)
+            continue;
+        unsigned long enters = __atomic_load_n(&ring->enters, __ATOMIC_RELAXED);
+        unsigned long completions = __atomic_load_n(&ring->completions, __ATOMIC_RELAXED);
+        fprintf(stderr, "%-7d %-11lu %lu\n", i, enters, completions);
+    }
+}